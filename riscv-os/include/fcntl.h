@@ -9,4 +9,8 @@
 #define O_CREATE  0x200   // 不存在则创建
 #define O_TRUNC   0x400   // 截断为 0
 
+// fallocate 的 mode（与 Linux 相同）
+#define FALLOC_FL_KEEP_SIZE   0x01   // 不改变文件大小（只有这一位时：预分配到文件末尾之外）
+#define FALLOC_FL_PUNCH_HOLE  0x02   // 打洞：释放这段的块，读出来是 0（必须和 KEEP_SIZE 一起用）
+
 #endif // _FCNTL_H_
@@ -0,0 +1,13 @@
+#ifndef _FDT_H_
+#define _FDT_H_
+
+#include "types.h"
+
+// 启动时固件（QEMU）通过 a1 传入的设备树（DTB）物理地址，由 start() 保存
+extern uint64 boot_dtb;
+
+// 从扁平设备树中找到第一个 memory 节点，取出它 reg 属性的第一段
+// 成功返回 0 并写回 [*base, *base + *size)；DTB 无效或找不到时返回 -1
+int fdt_memory(uint64 dtb, uint64 *base, uint64 *size);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "types.h"
 #include "fs.h"
+#include "uio.h"
 
 // 打开文件类型
 #define FD_NONE   0   // 空闲
@@ -32,4 +33,22 @@ int          filestat(struct file *f, uint64 addr);
 int          fileread(struct file *f, uint64 addr, int n);
 int          filewrite(struct file *f, uint64 addr, int n);
 
+// 分段读写：off < 0 时从 f->off 开始并推进它，否则从 off 开始、不碰 f->off（pread/pwrite）。
+// iov 已经拷进内核、检查过长度。返回读写的总字节数
+int          filereadv(struct file *f, struct iovec *iov, int iovcnt, int64 off);
+int          filewritev(struct file *f, struct iovec *iov, int iovcnt, int64 off);
+
+// 在内核里把 in 的内容拷到 out（copy_file_range/sendfile）。
+// inoff/outoff 为 0 时用并推进对应文件的 f->off，否则用并推进 *inoff/*outoff
+int          filecopy(struct file *in, uint32 *inoff, struct file *out, uint32 *outoff, int n);
+
+// dst 的内容换成和 src 共享数据块的克隆
+int          filereflink(struct file *src, struct file *dst);
+
+// fallocate：按 mode 预分配或打洞
+int          filefallocate(struct file *f, int mode, uint32 off, uint32 len);
+
+// sysfile.c：初始化 fd 表的锁
+void         sysfileinit(void);
+
 #endif // _FILE_H_
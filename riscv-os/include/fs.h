@@ -5,6 +5,8 @@
 #include "types.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mcslock.h"
+#include "pagecache.h"
 
 // ------------ 常量定义 ------------
 
@@ -30,6 +32,7 @@ struct superblock {
     uint32 logstart;   // 日志区起始块号
     uint32 inodestart; // inode 区起始块号
     uint32 bmapstart;  // 位图区起始块号
+    uint32 refstart;   // 块共享计数区起始块号（reflink），紧跟在位图后面
 };
 
 // ------------ 磁盘上的 inode 结构 ------------
@@ -60,12 +63,23 @@ struct dinode {
 // 第 b 个数据块对应的位图块块号
 #define BBLOCK(b, sb) ((b) / BPB + (sb).bmapstart)
 
+// 块共享计数：每块一个 uint16，记“除了第一个以外还有几个文件引用它”。
+// 没被 reflink 过的块是 0，balloc/bfree 的常见路径不用改它
+#define RPB (BSIZE / sizeof(uint16))
+
+// 第 b 个数据块的共享计数所在的块号
+#define RBLOCK(b, sb) ((b) / RPB + (sb).refstart)
+
+// addrs[] 和间接块里块号的最高位：fallocate 预分配、还没写过的块（未写入），读的时候当洞
+#define BUNWRITTEN 0x80000000U
+#define BADDR(a)   ((a) & ~BUNWRITTEN)
+
 // ------------ 内存中的 inode 结构 ------------
 
 struct inode {
     uint32 dev;                 // 所在设备号
     uint32 inum;                // inode 号
-    int    ref;                 // 引用计数（在 icache 中被多少地方引用）
+    int    ref;                 // 引用计数（在 icache 中被多少地方引用，原子修改）
 
     struct sleeplock lock;      // 保护下方字段
     int    valid;               // 是否已经从磁盘加载了元数据
@@ -77,13 +91,19 @@ struct inode {
     short  nlink;
     uint32 size;
     uint32 addrs[NDIRECT + 1];  // 数据块地址（最后一个为一级间接块）
+    int    idirty;              // 内存里的 size/addrs 比磁盘上的新，写回时要 iupdate
+    uint64 sync_seq;            // 最近一次改动它（元数据或数据）的日志批次，fsync 等它提交
+    uint64 datasync_seq;        // 最近一次改动数据或 size/addrs 的日志批次，fdatasync 等它提交
+
+    struct pcache pc;           // 文件数据的页缓存（pagecache.c）
 };
 
-// inode 缓存：固定大小的数组 + 自旋锁
+// inode 缓存：固定大小的数组 + MCS 队列锁
+// 查找命中走 RCU 读侧、只做一次 ref 原子加一；分配空槽、最后一次 iput 需要持锁。
 #define NINODE 50
 
 struct inode_cache {
-    struct spinlock lock;
+    struct mcslock  lock;
     struct inode    inode[NINODE];
 };
 
@@ -109,24 +129,28 @@ struct buf {
     uint32 blockno;             // 磁盘块号
 
     struct sleeplock lock;      // 保护 data 区
-    uint32 refcnt;              // 引用计数
-    struct buf *prev;           // LRU 链表（前驱）
-    struct buf *next;           // LRU 链表（后继）
+    uint32 refcnt;              // 引用计数（无锁读者用 CAS 加一，见 bio.c）
+    uint64 lastuse;             // 最近一次 brelse 的时间戳，用于近似 LRU
+    struct buf *hnext;          // 散列链（RCU 发布，读者无锁遍历）
 
     unsigned char data[BSIZE];  // 实际缓存的数据
 };
 
 // ------------ 日志结构 ------------
 
-// 日志中最多能记录多少个块（事务总和）
-#define LOGSIZE      30
+// mkfs（virtio_disk_init）给日志区分多少块（含日志头）。
+// 运行时的日志容量按超级块里的 nlog 算，不看这个值
+#define LOGSIZE      64
+
+// 日志头占一块，块号表最多能记多少个块
+#define LOGMAXBLOCKS ((BSIZE - sizeof(int)) / sizeof(int))
 
-// 单个文件系统操作最多会修改多少个块
+// 不说明预算的 begin_op() 默认预留多少块
 #define MAXOPBLOCKS  10
 
 struct logheader {
     int n;                      // 当前事务中涉及的块数
-    int block[LOGSIZE];         // 每个块在文件系统中的块号
+    int block[LOGMAXBLOCKS];    // 每个块在文件系统中的块号
 };
 
 struct log {
@@ -135,6 +159,9 @@ struct log {
     int size;                   // 日志区大小
     int outstanding;            // 正在进行的 FS 操作数量
     int committing;             // 是否正在提交（commit）
+    uint64 since;               // 攒着的事务里第一个块是什么时候记进来的（r_time）
+    uint64 seq;                 // 正在攒的这一批的编号，每提交一次加一
+    int reserved;               // 还没结束的操作一共预留了多少块
     int dev;                    // 日志所在设备号
     struct logheader lh;        // 内存中的日志头
 };
@@ -148,13 +175,19 @@ void        binit(void);
 struct buf* bread(uint32 dev, uint32 blockno);
 void        bwrite(struct buf *b);
 void        brelse(struct buf *b);
+struct buf* bgetblk(uint32 dev, uint32 blockno);
 
 // ------------ log.c 接口 ------------
 
 void initlog(int dev, struct superblock *sb);
 void begin_op(void);
+void begin_op_n(int nblocks);
+int  log_op_max(void);
 void end_op(void);
 void log_write(struct buf *b);
+int  log_force(void);
+int  log_force_seq(uint64 seq);
+int  log_read(struct buf *b);
 
 // ------------ fs.c 接口 ------------
 
@@ -174,6 +207,14 @@ void         itrunc(struct inode *ip);
 // 数据块读写
 int  readi(struct inode *ip, int user_dst, uint64 dst, uint32 off, uint32 n);
 int  writei(struct inode *ip, int user_src, uint64 src, uint32 off, uint32 n);
+int  writei_budget(struct inode *ip, uint32 off, uint32 n);
+int  copyi(struct inode *src, uint32 soff, struct inode *dst, uint32 doff, uint32 n);
+int  ireflink(struct inode *src, struct inode *dst);
+int  ipunch(struct inode *ip, uint32 off, uint32 len);
+int  iprealloc(struct inode *ip, uint32 off, uint32 len, int keep_size);
+uint32 ibmap_write(struct inode *ip, uint32 bn);
+uint32 brefcount(uint32 dev, uint32 bno);
+uint32 ibmap(struct inode *ip, uint32 bn, int alloc);
 
 // stat 信息（给 file.c / stat 系统调用使用）
 struct stat;
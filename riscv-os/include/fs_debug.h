@@ -13,6 +13,19 @@ extern uint64 disk_write_count;
 extern uint64 buffer_cache_hits;
 extern uint64 buffer_cache_misses;
 
+// pagecache.c 里累加
+extern uint64 pcache_hits;
+extern uint64 pcache_misses;
+extern uint64 pcache_pages;
+extern uint64 pcache_dirty;
+
+// log.c 里累加
+extern uint64 log_commits;
+
+// writeback.c 里累加
+extern uint64 writeback_pages;
+extern uint64 writeback_runs;
+
 // ---- 调试/检查接口 ----
 void debug_filesystem_state(void);  // 打印 superblock + 空闲统计 + cache 统计
 void debug_inode_usage(void);       // 打印 inode cache 的占用情况（ref>0 的项）
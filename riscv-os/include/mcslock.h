@@ -0,0 +1,44 @@
+// include/mcslock.h
+#ifndef _MCSLOCK_H_
+#define _MCSLOCK_H_
+
+#include "types.h"
+#include "spinlock.h"
+#include "proc.h"     // NCPU, struct cpu
+
+// MCS 队列锁：
+// - 等待者按到达顺序排成链表，每个 CPU 只在自己的节点上自旋，
+//   不会像 test-and-set 那样让所有等待者争抢同一个 cache line；
+// - 先到先得，避免 TAS 锁在多核上的饥饿问题。
+// 接口与 spinlock 一致（关中断可嵌套、记录持有者和统计），
+// 只是不能递归获取：每个 CPU 在每把锁上只有一个排队节点。
+
+#define MCS_CACHELINE 64
+
+struct mcs_node {
+    struct mcs_node *volatile next;   // 排在自己后面的等待者
+    volatile int locked;              // 1：仍在等待前驱交出锁
+} __attribute__((aligned(MCS_CACHELINE)));
+
+struct mcslock {
+    char *name;                       // 锁的名字，方便调试
+    struct mcs_node *volatile tail;   // 队尾；0 表示锁空闲
+    struct cpu *cpu;                  // 当前持有者
+
+    // 统计信息：只在持锁期间修改，由锁本身保护
+    uint64 nacquire;
+    uint64 ncontended;
+    uint64 spin_cycles;
+
+    struct mcs_node node[NCPU];       // 每个 CPU 在这把锁上的排队节点
+};
+
+void initmcslock(struct mcslock *lk, char *name);
+void mcs_acquire(struct mcslock *lk);
+void mcs_release(struct mcslock *lk);
+int  mcs_holding(struct mcslock *lk);
+
+// 调试接口：打印所有已注册 MCS 锁的获取/竞争统计
+void debug_mcslock_stats(void);
+
+#endif // _MCSLOCK_H_
@@ -1,15 +1,30 @@
 #ifndef _MEMLAYOUT_H_
 #define _MEMLAYOUT_H_
 
+#ifndef __ASSEMBLER__
 #include "types.h"
+#endif
 
 #define UART0    0x10000000L   // QEMU virt 上的 UART0
 #define KERNBASE 0x80000000L   // 内核加载物理地址
-#define PHYSTOP  (KERNBASE + 128*1024*1024L)  // 先假定只用前 128MB
+#define PHYSTOP  (KERNBASE + 128*1024*1024L)  // 设备树里读不到内存大小时的默认上界
+#define PHYSTOP_MAX (KERNBASE + 64*1024*1024*1024L)  // 恒等映射要落在 Sv39 的 MAXVA 以内
 
 #define PGSIZE   4096
 #define MAXVA    (1L << (9+9+9+12-1))
 
+// 用户代码/栈/堆都放在 [0, USERTOP)：内核的全局映射从 UART0 开始，
+// 用户地址不能和它们重叠，否则会命中全局 TLB 项。
+#define USERTOP    UART0
+
+// 每个用户进程的栈区大小：按需分配，碰到才给物理页
+#define USTACK_SIZE (8 * PGSIZE)
+
+// 用户地址空间的最高两页：所有地址空间都在 TRAMPOLINE 映射同一页陷入/返回代码，
+// 每个进程在 TRAPFRAME 映射自己的 trapframe。
+#define TRAMPOLINE (MAXVA - PGSIZE)
+#define TRAPFRAME  (TRAMPOLINE - PGSIZE)
+
 #define PGROUNDUP(sz)  ((((uint64)(sz)) + PGSIZE - 1) & ~((uint64)PGSIZE - 1))
 #define PGROUNDDOWN(a) (((uint64)(a)) & ~((uint64)PGSIZE - 1))
 
@@ -0,0 +1,46 @@
+// include/mman.h
+#ifndef _MMAN_H_
+#define _MMAN_H_
+
+// mmap 的 prot / flags（数值与 Linux 相同）
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+
+#define MAP_SHARED   0x01   // 写入对文件可见，msync/munmap/退出时写回
+#define MAP_PRIVATE  0x02   // 写时复制一份私有页，永不写回
+
+#ifndef __ASSEMBLER__   // 以下只给 C 代码用
+
+#include "types.h"
+
+// 每个进程最多同时存在的文件映射数
+#define NVMA 8
+
+struct file;
+struct proc;
+struct inode;
+
+// 一段文件映射 [start, end)，对应文件从 off 开始的内容
+struct vma {
+  uint64 start;
+  uint64 end;          // 0 表示空槽
+  int prot;            // PROT_xxx
+  int flags;           // MAP_SHARED / MAP_PRIVATE
+  struct file *file;   // 映射期间持有一个引用
+  uint64 off;          // 页对齐
+};
+
+// kernel/mmap.c
+uint64      mmap_region(struct proc *p, uint64 len, int prot, int flags,
+                        struct file *f, uint64 off);
+int         munmap_region(struct proc *p, uint64 addr, uint64 len);
+int         msync_region(struct proc *p, uint64 addr, uint64 len);
+struct vma* vma_lookup(struct proc *p, uint64 va);
+int         vma_fault(struct proc *p, struct vma *v, uint64 va, int write);
+int         vma_fork(struct proc *p, struct proc *np);
+void        vma_exit(struct proc *p);
+void        vma_zap_range(struct inode *ip, uint64 from, uint64 to);
+
+#endif  // __ASSEMBLER__
+
+#endif // _MMAN_H_
@@ -0,0 +1,88 @@
+// include/pagecache.h
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+#include "types.h"
+
+// ------------ 文件数据页缓存 ------------
+//
+// 每个 inode 一棵基数树，按页号（文件偏移 / PGSIZE）索引它缓存的数据页；
+// 块缓存（bio.c）只管元数据和写穿时的中转。
+// 树的每个结点 64 路，从 slab 分配；最底层的槽里直接放数据页地址。
+// 整棵树由 inode 的 sleeplock 保护；没人引用的 inode 可以在持有 icache.lock 时被回收。
+
+#define PC_SHIFT 6
+#define PC_SLOTS (1 << PC_SHIFT)
+
+// 页缓存最多占多少页，超过后先回收 ref==0 的 inode 上的缓存
+#define PCACHE_MAX_PAGES 2048
+
+// 写回阈值：
+//   脏页超过 WB_DIRTY_BACKGROUND，或者有脏数据/攒着的日志放了超过 WB_EXPIRE，
+//   就唤起写回线程在后台写；超过 WB_DIRTY_LIMIT 时写者自己同步写回。
+#define WB_DIRTY_BACKGROUND (PCACHE_MAX_PAGES / 8)
+#define WB_DIRTY_LIMIT      (PCACHE_MAX_PAGES / 4)
+#define WB_EXPIRE           (5 * 1000000UL)   // r_time 计数，QEMU virt 上约 0.5 秒
+
+// 写回事务里除数据块以外最多还改几块：inode 块、间接块、跨界时的两个位图块、
+// 写时复制共享块时的共享计数块。
+// 一个事务写多少页由日志容量决定（log_op_max() - WB_OP_OVERHEAD）
+#define WB_OP_OVERHEAD      5
+
+struct pc_node;
+
+struct pcache {
+    struct pc_node *root;
+    int    height;       // 0 表示空树；高度 h 覆盖页号 [0, 64^h)
+    uint32 nrpages;      // 树里缓存的页数
+    uint32 nrdirty;      // 其中还没写回磁盘的脏页数
+    int    pinned;       // 有脏数据时为 1，并替写回多拿一个 inode 引用
+    uint64 dirtied_when; // 从干净变脏的时间（r_time）
+};
+
+struct inode;
+
+// 已缓存的第 index 页，没有返回 0
+char *pcache_lookup(struct inode *ip, uint32 index);
+
+// 第 index 页，不在缓存里就装入：fill 时从磁盘读（空洞读成 0），否则只清零
+// （调用者马上整页覆盖）。内存不足返回 0。调用者持有 ip->lock
+char *pcache_get(struct inode *ip, uint32 index, int fill);
+
+// 把缓存里的第 index 页写到对应的磁盘块（需要时分配，共享块写时复制）。调用者持有 ip->lock 且在事务里
+void  pcache_write_page(struct inode *ip, uint32 index);
+
+// 标记第 index 页为脏（必须已缓存）。调用者持有 ip->lock
+void  pcache_set_dirty(struct inode *ip, uint32 index);
+
+// 按页号顺序写回最多 max 个脏页并清掉脏标记，返回写了几页。
+// 调用者持有 ip->lock 且在事务里
+int   pcache_writeback(struct inode *ip, int max);
+
+// 丢掉页号 >= from 的缓存页（脏页直接丢弃）。用户映射着的页先从各进程的页表里拆掉
+void  pcache_truncate(struct inode *ip, uint32 from);
+
+// 只丢掉页号在 [from, to) 的页（打洞、写失败时用）
+void  pcache_drop(struct inode *ip, uint32 from, uint32 to);
+
+// ------------ 写回（writeback.c） ------------
+
+// 把 ip 的脏页和 inode 元数据写回，分成多个事务；写干净后放掉 pinned 的引用。
+// 调用者持有 ip 的引用，不持有 ip->lock，也不在事务里。返回写回的页数
+int   writeback_inode(struct inode *ip);
+
+// fsync/fdatasync：写回 ip，再等它所在的日志批次提交。
+// datasync 时只等数据和 size/addrs 的改动，不等 nlink 之类别的元数据。
+// 调用者持有 ip 的引用，不持有 ip->lock，也不在事务里。成功返回 0
+int   writeback_fsync(struct inode *ip, int datasync);
+
+// 写回所有脏 inode 并提交日志
+void  writeback_sync(void);
+
+// 有到期的脏数据/日志或者脏页超过后台阈值时唤起写回线程（end_op、filewrite、munmap、时钟中断调用）
+void  writeback_kick(void);
+
+// 写者在 filewrite 后调用：脏页超过 WB_DIRTY_LIMIT 时同步写回
+void  writeback_balance(void);
+
+#endif // _PAGECACHE_H_
@@ -3,11 +3,71 @@
 
 #include "types.h"
 
-// 初始化物理内存管理器（建立空闲页链表）
+// 伙伴系统支持的最大阶：一次最多分配 2^(MAX_ORDER-1) 个连续页（4MB）
+#define MAX_ORDER 11
+
+// 分配者标签：用于按子系统统计内存占用
+enum mem_tag {
+    MT_OTHER = 0,    // 未指明（alloc_page/alloc_pages 的默认值）
+    MT_PGTABLE,      // 页表页
+    MT_KSTACK,       // 内核栈
+    MT_SLAB,         // slab 分配器持有的页
+    MT_KMALLOC,      // kmalloc 的大块（超过 KMALLOC_MAX）
+    MT_USER,         // 用户进程的内存页和 trapframe
+    MT_PAGECACHE,    // 文件数据页缓存
+    NMEMTAG
+};
+
+// 物理内存上界（不含）：pmm_init 从设备树读出，读不到时为 PHYSTOP
+extern uint64 phys_top;
+
+// 初始化物理内存管理器（探测内存大小，建立伙伴系统空闲链表）
 void pmm_init(void);
 
 // 分配/释放一个物理页（4KB），返回物理地址（恒等映射下也可当作虚拟地址用）
+// 常见路径只操作本 CPU 的页缓存，缓存空/满时才成批访问伙伴系统
 void *alloc_page(void);
+void *alloc_page_tag(int tag);
 void free_page(void *pa);
 
+// 分配/释放 2^order 个物理上连续的页，返回首地址（按块大小对齐）
+// 释放时的 order 必须与分配时一致
+void *alloc_pages(int order);
+void *alloc_pages_tag(int order, int tag);
+void free_pages(void *pa, int order);
+
+// 已分配页（块首页）的引用计数：分配时为 1，COW 共享时增加；
+// free_page/free_pages 只在引用减到 0 时才真正释放
+void   page_ref_inc(void *pa);
+uint32 page_refcnt(void *pa);
+
+// 找到包含 pa 的已分配块，返回块首地址（order 非空时写回块的阶）
+void *pmm_block_head(void *pa, int *order);
+
+// slab 分配器用：标记/查询一个已分配块是否被用作 slab
+void pmm_set_slab(void *pa, int on);
+int  pmm_is_slab(void *pa);
+
+// 当前空闲页总数（伙伴系统 + 各 CPU 页缓存）
+uint64 pmm_free_pages(void);
+
+// 伙伴系统中某一阶当前的空闲块数
+uint64 pmm_free_blocks(int order);
+
+// 内存统计快照（单位：页）
+struct mem_stats {
+    uint64 total_pages;               // 伙伴系统管理的页数
+    uint64 free_pages;
+    uint64 used_pages;
+    uint64 peak_pages;                // 自启动以来离开伙伴系统的页数峰值
+    uint64 free_blocks[MAX_ORDER];    // 伙伴系统每阶空闲块数
+    int64  tag_pages[NMEMTAG];        // 每个标签当前占用的页数
+    uint64 tag_allocs[NMEMTAG];       // 每个标签累计分配次数
+};
+
+void pmm_get_stats(struct mem_stats *ms);
+
+// 调试接口：打印内存总量/峰值、按标签的占用和碎片情况
+void debug_memory_state(void);
+
 #endif
@@ -2,6 +2,9 @@
 #define _PROC_H_
 
 #include "types.h"
+#include "spinlock.h"
+#include "vm.h"
+#include "mman.h"
 
 // 和 swtch.S 对齐的上下文结构：顺序必须是 ra, sp, s0-s11
 struct context {
@@ -23,6 +26,48 @@ struct context {
   uint64 s11;
 };
 
+// 用户进程陷入内核时保存寄存器的地方，每个进程一页，映射在 TRAPFRAME。
+// 偏移必须和 trampoline.S 一致；a0~a7 连续存放，
+// syscall() 直接把 &a0 当作 struct syscall_frame 使用。
+struct trapframe {
+  /*   0 */ uint64 kernel_satp;   // 内核页表
+  /*   8 */ uint64 kernel_sp;     // 该进程内核栈栈顶
+  /*  16 */ uint64 kernel_trap;   // usertrap() 的地址
+  /*  24 */ uint64 epc;           // 用户 pc
+  /*  32 */ uint64 kernel_hartid; // 内核里的 tp
+  /*  40 */ uint64 ra;
+  /*  48 */ uint64 sp;
+  /*  56 */ uint64 gp;
+  /*  64 */ uint64 tp;
+  /*  72 */ uint64 t0;
+  /*  80 */ uint64 t1;
+  /*  88 */ uint64 t2;
+  /*  96 */ uint64 s0;
+  /* 104 */ uint64 s1;
+  /* 112 */ uint64 a0;
+  /* 120 */ uint64 a1;
+  /* 128 */ uint64 a2;
+  /* 136 */ uint64 a3;
+  /* 144 */ uint64 a4;
+  /* 152 */ uint64 a5;
+  /* 160 */ uint64 a6;
+  /* 168 */ uint64 a7;
+  /* 176 */ uint64 s2;
+  /* 184 */ uint64 s3;
+  /* 192 */ uint64 s4;
+  /* 200 */ uint64 s5;
+  /* 208 */ uint64 s6;
+  /* 216 */ uint64 s7;
+  /* 224 */ uint64 s8;
+  /* 232 */ uint64 s9;
+  /* 240 */ uint64 s10;
+  /* 248 */ uint64 s11;
+  /* 256 */ uint64 t3;
+  /* 264 */ uint64 t4;
+  /* 272 */ uint64 t5;
+  /* 280 */ uint64 t6;
+};
+
 // 内核线程状态（别和之前 trap.c 的 enum 混）
 typedef enum {
   PROC_UNUSED = 0,
@@ -32,19 +77,69 @@ typedef enum {
 } procstate_t;
 
 #define NPROC 4    // 实验就搞几个内核线程够用了
+#define NCPU  4    // 最多支持的 hart 数量
+
+// 内核栈：2^KSTACK_ORDER 个物理上连续的页（由伙伴系统分配）
+#define KSTACK_ORDER 1
+#define KSTACK_SIZE  (PGSIZE << KSTACK_ORDER)
 
 // 极简版“进程/内核线程”结构
 struct proc {
   int pid;                 // 简单自增 pid
   procstate_t state;       // 当前状态
-  uint64 kstack;           // 内核栈起始虚拟地址（1 页）
+  uint64 kstack;           // 内核栈起始虚拟地址（KSTACK_SIZE 字节）
   struct context context;  // 用于 swtch 的上下文
   char name[16];           // 调试用名字
+  int cpu;                 // 上一次运行所在的 CPU（-1 表示还没运行过）
+
+  // 以下只对用户进程有效；内核线程的 pagetable 为 0
+  pagetable_t pagetable;       // 用户页表
+  struct trapframe *trapframe; // 陷入时保存的用户寄存器
+  uint64 sz;                   // 用户地址空间大小 [0, sz)，堆顶（sbrk 的 break）
+  uint64 heapbase;             // 堆的起点，sbrk 不能缩到它下面
+  uint64 guard;                // 栈下方的 guard page，永远不映射
+  uint64 mmapbase;             // 文件映射区的下界，从 USERTOP 往下分配，堆不能长过它
+  struct vma vmas[NVMA];       // 文件映射（mmap.c）
+  uint64 asid;                 // 当前分到的 ASID
+  uint64 asid_gen;             // asid 属于哪一代（和全局代数不同就要重新分配）
+  int killed;                  // 非零：下次回到用户态前退出
+  int xstate;                  // 退出码
 };
 
-// 全局进程表 & 当前正在运行的线程
+// 每个 CPU 私有的就绪队列：环形数组，存放 RUNNABLE 线程
+struct runqueue {
+  struct spinlock lock;
+  struct proc *q[NPROC];
+  int head;                // 队头下标（最早入队的线程）
+  int count;               // 当前排队的线程数
+};
+
+// 每个 CPU 的调度器状态
+struct cpu {
+  struct proc *proc;       // 本 CPU 上正在运行的线程，没有为 0
+  struct context context;  // 调度器自己的上下文（scheduler_run 所在的栈）
+  struct runqueue rq;      // 本 CPU 的就绪队列
+  int noff;                // push_off() 的嵌套深度
+  int intena;              // 最外层 push_off() 之前中断是否打开
+
+  uint64 asid_gen;         // 本 CPU 的 TLB 已经刷到哪一代 ASID
+  pagetable_t upt;         // 上一次在本 CPU 运行的用户页表（不支持 ASID 时判断是否要刷 TLB）
+
+  // 统计信息：除 nstolen 外只由本 CPU 修改，无需加锁
+  uint64 nswitch;          // 切换到线程的次数
+  uint64 nsteal;           // 空闲时从其它 CPU 偷到线程的次数
+  uint64 nstolen;          // 被其它 CPU 偷走的线程数（由偷的那个 CPU 原子地加）
+  uint64 nmigrate;         // 在本 CPU 运行、但上次运行在别的 CPU 上的次数
+};
+
+// 全局进程表 & 每个 CPU 的状态
 extern struct proc procs[NPROC];
-extern struct proc *current_proc;
+extern struct cpu cpus[NCPU];
+
+// 当前 hart 号（保存在 tp 中）、对应的 struct cpu，以及本 CPU 上正在运行的线程
+int cpuid(void);
+struct cpu *mycpu(void);
+struct proc *myproc(void);
 
 // 接口：初始化、创建线程、调度器、让出 CPU、退出
 void proc_init(void);
@@ -53,4 +148,23 @@ void scheduler_run(void);
 void yield(void);
 void kproc_exit(void);
 
+// 用户进程：code 是一段位置无关的机器码，拷到用户地址 0 处运行
+struct proc *uproc_create(const void *code, uint64 len, const char *name);
+void uproc_exit(int status);
+int  uproc_fork(void);
+int  proc_grow(int64 n);
+int  proc_fault(struct proc *p, uint64 va, int write);
+uint64 proc_satp(struct proc *p);
+
+// 用户页表的映射被收回/改小之后刷 TLB；va 为 -1 时刷整个地址空间
+void proc_tlb_flush(struct proc *p, uint64 va);
+
+// 在内核地址和（当前进程的）用户地址之间拷数据：
+// user 非零且当前进程有用户页表时 addr 是用户地址，否则按内核指针处理
+int either_copyout(int user_dst, uint64 dst, const void *src, uint64 len);
+int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
+
+// 调试接口：打印每个 CPU 的就绪队列长度和 steal/migrate 统计
+void debug_sched_state(void);
+
 #endif
@@ -0,0 +1,24 @@
+// include/rcu.h
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include "types.h"
+
+// 基于 epoch 的简化 RCU：
+// - 读者用 rcu_read_lock()/rcu_read_unlock() 包住无锁查找，
+//   期间只写本 CPU 私有的 epoch 记录，不碰任何共享锁字；
+// - 写者把对象从查找结构中摘下后调用 synchronize_rcu()，
+//   等所有在此之前进入读侧临界区的 CPU 都离开，才能复用该对象。
+// 读侧临界区内不能睡眠/yield，也不能等待会被写者持有的锁。
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void synchronize_rcu(void);
+
+// 把一个指针发布给无锁读者（release 语义：之前的初始化先可见）
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// 读者读取被发布的指针（acquire 语义：保证能看到发布前的初始化）
+#define rcu_dereference(p)       __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+#endif // _RCU_H_
@@ -243,7 +243,13 @@ w_stimecmp(uint64 x)
     asm volatile("csrw stimecmp, %0" : : "r"(x));
 }
 
-// ------------ sfence ------------
+// ------------ satp / sfence ------------
+
+// satp：MODE=8 表示 Sv39，[59:44] 是 ASID，[43:0] 是根页表的物理页号
+#define SATP_SV39        (8L << 60)
+#define SATP_ASID_SHIFT  44
+#define SATP_ASID_MASK   0xffffL
+#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)(pagetable)) >> 12))
 
 static inline void
 sfence_vma(void)
@@ -251,6 +257,20 @@ sfence_vma(void)
     asm volatile("sfence.vma zero, zero");
 }
 
+// 只刷掉某个 ASID 的非全局 TLB 项
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+    asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
+// 只刷掉某个 ASID 下某个虚拟地址的 TLB 项
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid));
+}
+
 // ------------ interrupt helpers ------------
 
 static inline void
@@ -0,0 +1,33 @@
+// include/rwlock.h
+#ifndef _RWLOCK_H_
+#define _RWLOCK_H_
+
+#include "types.h"
+#include "spinlock.h"
+
+// 读写自旋锁：
+// - 多个读者可以同时持有，适合“绝大多数是查找”的路径。目前只有 fd 表（sysfile.c）
+//   在用（iget()/bget() 的查找已经改成 RCU 无锁，见 rcu.h）；
+// - 写者独占；有写者在等待时新读者不再进入，避免写者饿死。
+// 和 spinlock 一样在持锁期间关中断（push_off/pop_off 可嵌套）。
+// 注意：读锁不能递归获取，否则遇到等待中的写者会死锁。
+struct rwspinlock {
+    char *name;              // 锁的名字，方便调试
+    volatile int cnt;        // >0：读者数量；-1：写者持有；0：空闲
+    volatile int wwait;      // 正在等待的写者数量
+    struct cpu *wcpu;        // 持有写锁的 CPU
+
+    // 统计信息：只统计写锁，由写锁本身保护；读路径不写任何共享计数
+    uint64 nwrite;           // 写锁获取次数
+    uint64 ncontended;       // 写锁需要等待的次数
+    uint64 spin_cycles;      // 写锁累计自旋周期
+};
+
+void initrwlock(struct rwspinlock *lk, char *name);
+void read_acquire(struct rwspinlock *lk);
+void read_release(struct rwspinlock *lk);
+void write_acquire(struct rwspinlock *lk);
+void write_release(struct rwspinlock *lk);
+int  write_holding(struct rwspinlock *lk);
+
+#endif // _RWLOCK_H_
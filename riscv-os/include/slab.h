@@ -0,0 +1,70 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "types.h"
+#include "spinlock.h"
+#include "proc.h"     // NCPU
+
+// ------------ slab 分配器 ------------
+//
+// 每种对象一个 kmem_cache：从伙伴系统拿一块连续页（一个 slab），
+// 切成等大的对象；slab 头放在块的开头，释放对象时按块大小对齐
+// 就能找回所属的 slab。
+// 每个 CPU 在每个 cache 上有一个“弹匣”（magazine），缓存少量空闲对象，
+// 常见的分配/释放只操作本 CPU 的弹匣，不需要拿 cache 的锁。
+// 构造函数在 slab 创建时对每个对象调用一次：对象释放回 cache 时
+// 应保持“已构造”状态，再次分配时不会重新构造。
+
+#define SLAB_MAG_SIZE 16   // 每个 CPU 弹匣最多缓存的对象数
+
+struct slab;
+
+struct kmem_magazine {
+    int   count;
+    void *objs[SLAB_MAG_SIZE];
+} __attribute__((aligned(64)));
+
+struct kmem_cache {
+    char   name[16];
+    uint32 objsize;          // 按对齐要求向上取整后的对象大小
+    uint32 align;
+    int    order;            // 每个 slab 占 2^order 页
+    uint32 nobjs;            // 每个 slab 的对象数
+    uint32 offset;           // 第一个对象相对 slab 起始的偏移
+    void (*ctor)(void *);    // 构造函数，可为 0
+
+    struct spinlock lock;    // 保护下面的 slab 链表和统计
+    struct slab *partial;    // 部分使用的 slab
+    struct slab *full;       // 已满的 slab
+    struct slab *empty;      // 完全空闲的 slab（最多保留一个）
+
+    uint64 nslabs;           // 当前持有的 slab 数
+    uint64 nactive;          // 已分配出去的对象数（不含弹匣里的）
+
+    struct kmem_magazine mag[NCPU];
+};
+
+// 初始化 slab 子系统和 kmalloc 的各尺寸 cache（需在 pmm_init 之后调用）
+void slab_init(void);
+
+// 创建对象 cache：size 字节的对象，按 align 对齐（0 表示默认 8 字节）
+struct kmem_cache *kmem_cache_create(const char *name, uint32 size, uint32 align,
+                                     void (*ctor)(void *));
+void *kmem_cache_alloc(struct kmem_cache *c);
+void  kmem_cache_free(struct kmem_cache *c, void *obj);
+
+// 把弹匣和空闲 slab 里的内存还给伙伴系统
+void  kmem_cache_shrink(struct kmem_cache *c);
+
+// 通用分配：小对象走按 2 的幂划分的 kmalloc cache，
+// 超过 KMALLOC_MAX 的直接向伙伴系统要连续页
+#define KMALLOC_MIN 16
+#define KMALLOC_MAX 2048
+
+void *kmalloc(uint64 size);
+void  kfree(void *p);
+
+// 调试接口：打印所有 cache 的使用情况
+void debug_slab_state(void);
+
+#endif
@@ -5,53 +5,40 @@
 #include "types.h"
 #include "riscv.h"
 
-// 简单自旋锁：在本实验的单核环境里，主要用于关闭中断 + 原子设置标志
+struct cpu;
+
+// 自旋锁：关中断（可嵌套）+ 原子设置标志，并记录持有者和竞争统计
 struct spinlock {
-    char *name;   // 锁的名字，方便调试
-    int  locked;  // 0 表示未持有，1 表示已经被某个执行流持有
+    char *name;            // 锁的名字，方便调试
+    volatile int locked;   // 0 表示未持有，1 表示已经被某个 CPU 持有
+    struct cpu *cpu;       // 持有该锁的 CPU（用于 holding() 检查）
+
+    // 统计信息：只在持锁期间修改，由锁本身保护
+    uint64 nacquire;       // 成功获取的次数
+    uint64 ncontended;     // 第一次尝试就失败、需要自旋的次数
+    uint64 spin_cycles;    // 自旋等待累计耗费的 time CSR 周期数
 };
 
 // 原子交换：返回旧值
 static inline int
 atomic_xchg(volatile int *addr, int newval)
 {
-    // GCC/Clang 提供的内建原子指令，适用于 RISC-V
+    // GCC/Clang 提供的内建原子指令，适用于 RISC-V（带 acquire 语义）
     return __sync_lock_test_and_set(addr, newval);
 }
 
-// 初始化自旋锁
-static inline void
-initlock(struct spinlock *lk, char *name)
-{
-    lk->name   = name;
-    lk->locked = 0;
-}
-
-// 当前是否持有该锁（这里只是看标志位，足够实验使用）
-static inline int
-holding(struct spinlock *lk)
-{
-    return lk->locked != 0;
-}
-
-// 加锁：关闭中断 + 自旋等待 locked 变为 0
-static inline void
-acquire(struct spinlock *lk)
-{
-    intr_off();               // 关闭中断，避免在持锁期间被打断
+// spinlock.c 提供的接口
+void initlock(struct spinlock *lk, char *name);
+void acquire(struct spinlock *lk);
+void release(struct spinlock *lk);
+int  holding(struct spinlock *lk);
 
-    // 自旋等待其它执行流释放该锁
-    while (atomic_xchg(&lk->locked, 1) != 0) {
-        // busy wait
-    }
-}
+// 可嵌套的关/开中断：push_off 记录最外层进入前的中断状态，
+// 只有配对的最后一次 pop_off 才会恢复它
+void push_off(void);
+void pop_off(void);
 
-// 解锁：清除标志位 + 重新打开中断
-static inline void
-release(struct spinlock *lk)
-{
-    lk->locked = 0;
-    intr_on();
-}
+// 调试接口：按名字汇总打印所有已注册锁的获取/竞争统计
+void debug_lock_stats(void);
 
 #endif // _SPINLOCK_H_
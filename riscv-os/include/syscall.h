@@ -2,7 +2,9 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
+#ifndef __ASSEMBLER__
 #include "types.h"
+#endif
 
 // --- 系统调用号（实验 6 + 实验 7） ---
 // 1~5：实验六
@@ -20,6 +22,27 @@
 #define SYS_fstat     10   // 查询文件状态
 #define SYS_dup       11   // 复制文件描述符
 
+// 12~：用户进程
+#define SYS_exit      12   // 用户进程退出：exit(status)
+#define SYS_fork      13   // 写时复制 fork：父进程返回子进程 pid，子进程返回 0
+#define SYS_sbrk      14   // 调整堆顶：sbrk(n)，返回原来的 break；新增部分按需分配
+#define SYS_mmap      15   // mmap(0, len, prot, flags, fd, off)：映射文件，缺页时装入
+#define SYS_munmap    16   // munmap(addr, len)：拆映射，共享脏页写回
+#define SYS_msync     17   // msync(addr, len)：共享脏页写回文件
+#define SYS_fsync     18   // fsync(fd)：写回该文件的脏页和 inode 并提交日志
+#define SYS_fdatasync 19   // fdatasync(fd)：同 fsync，但只有数据/size 变了才提交日志
+#define SYS_sync      20   // sync()：写回所有文件并提交日志
+#define SYS_readv     21   // readv(fd, iov, iovcnt)：一次读进多段缓冲区
+#define SYS_writev    22   // writev(fd, iov, iovcnt)：多段缓冲区在一个事务里写出
+#define SYS_pread     23   // pread(fd, buf, n, off)：从 off 读，不改文件偏移
+#define SYS_pwrite    24   // pwrite(fd, buf, n, off)：写到 off，不改文件偏移
+#define SYS_copy_file_range 25 // copy_file_range(fd_in, &off_in, fd_out, &off_out, len)：内核里拷文件
+#define SYS_sendfile  26   // sendfile(out_fd, in_fd, &off, count)：把 in_fd 的内容拷到 out_fd
+#define SYS_reflink   27   // reflink(src_fd, dst_fd)：dst 变成 src 的克隆，共享数据块、写时复制
+#define SYS_fallocate 28   // fallocate(fd, mode, off, len)：预分配 / 打洞
+
+#ifndef __ASSEMBLER__   // 以下只给 C 代码用，initcode.S 只需要上面的调用号
+
 // --- 简化版“系统调用帧” ---
 // 模拟 RISC-V 中 a0~a7 寄存器的内容。
 // 真正用到用户态时，可以直接用 trapframe 中的 a0..a7。
@@ -42,4 +65,6 @@ void argint(int n, int *ip);
 void argaddr(int n, uint64 *ip);
 int  argstr(int n, char *buf, int max);
 
+#endif  // __ASSEMBLER__
+
 #endif
@@ -7,4 +7,10 @@ void trapinit(void);
 // 为当前 hart 设置 stvec -> kernelvec
 void trapinithart(void);
 
+// 从用户态陷入后的处理入口（trampoline.S 跳过来）
+void usertrap(void);
+
+// 返回当前进程的用户态，不返回
+void usertrapret(void);
+
 #endif
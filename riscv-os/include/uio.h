@@ -0,0 +1,16 @@
+// include/uio.h
+#ifndef _UIO_H_
+#define _UIO_H_
+
+#include "types.h"
+
+// readv/writev 一次最多多少段
+#define IOV_MAX 16
+
+// 一段用户缓冲区（布局与 Linux 相同）
+struct iovec {
+    uint64 iov_base;   // 用户地址
+    uint64 iov_len;    // 字节数
+};
+
+#endif // _UIO_H_
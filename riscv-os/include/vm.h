@@ -6,9 +6,27 @@
 typedef uint64  pte_t;
 typedef uint64* pagetable_t;
 
+// PTE 标志位
+#define PTE_V (1L << 0)  // 有效
+#define PTE_R (1L << 1)  // 可读
+#define PTE_W (1L << 2)  // 可写
+#define PTE_X (1L << 3)  // 可执行
+#define PTE_U (1L << 4)  // 用户态访问
+#define PTE_G (1L << 5)  // 全局映射：所有地址空间共享，切换 ASID 时不必刷掉
+#define PTE_A (1L << 6)
+#define PTE_D (1L << 7)
+#define PTE_COW (1L << 8)  // RSW 软件位：写时复制的共享页（此时 PTE_W 已清掉）
+
+#define PTE_FLAGS(pte) ((pte) & 0x3FFUL)
+#define PTE_PA(pte)    (((pte) >> 10) << 12)
+#define PA2PTE(pa)     ((((uint64)(pa)) >> 12) << 10)
+
 // 全局内核页表指针
 extern pagetable_t kernel_pagetable;
 
+// 硬件实现的最大 ASID（0 表示不支持 ASID，切换地址空间时只能整体刷 TLB）
+extern uint64 asid_max;
+
 // 构建内核页表（恒等映射）但尚未写入 satp
 void kvminit(void);
 
@@ -19,4 +37,28 @@ void kvminithart(void);
 pagetable_t create_pagetable(void);
 int map_page(pagetable_t pt, uint64 va, uint64 pa, int perm);
 
+// va 对应的叶子 PTE；alloc 时按需分配中间页表页
+pte_t *walk(pagetable_t pagetable, uint64 va, int alloc);
+
+// 用户地址空间
+uint64 walkaddr(pagetable_t pagetable, uint64 va);
+void   uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free);
+void   uvmfree(pagetable_t pagetable, uint64 sz);
+int    copyout(pagetable_t pagetable, uint64 dstva, const void *src, uint64 len);
+int    copyin(pagetable_t pagetable, void *dst, uint64 srcva, uint64 len);
+int    copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max);
+
+// 写时复制：fork 时共享 [0, sz) 的所有用户页，写缺页时再复制
+int    uvmcopy_cow(pagetable_t old, pagetable_t new, uint64 sz);
+int    uvm_cow_fault(pagetable_t pagetable, uint64 va);
+
+// 缺页时按需分配/复制 va 所在页（懒分配 + 写时复制）
+int    uvm_fault_in(pagetable_t pagetable, uint64 va, int write);
+
+// va 所在叶子映射的权限位（PTE 低 10 位），未映射返回 0
+uint64 vm_mapping_flags(pagetable_t pt, uint64 va);
+
+// va 所在叶子映射的大小（4KB / 2MB / 1GB），未映射返回 0
+uint64 vm_mapping_size(pagetable_t pt, uint64 va);
+
 #endif
@@ -3,6 +3,9 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "mcslock.h"
+#include "rcu.h"
+#include "riscv.h"
 #include "printf.h"
 #include "fs_debug.h"
 
@@ -14,49 +17,146 @@ uint64 buffer_cache_misses = 0;
 extern void virtio_disk_rw(struct buf *b, int write);
 extern void virtio_disk_init(void);
 
-// 块缓存全局状态：一个双向环形链表 + 固定数组
+// 块缓存全局状态：固定数组 + 按 (dev, blockno) 散列的单链表。
+//
+// 查找命中走 RCU 读侧，不碰任何锁：在散列链上找到 buf 后，
+// 用 CAS 把 refcnt 原子加一“钉住”它，再复查 (dev, blockno)。
+// 只有未命中、需要换出 buf 时才拿 bcache.lock。
+// 换出流程：CAS 把 refcnt 从 0 改成 BUF_EVICTING（此后读者钉不住它）
+//   -> 从旧散列链摘下 -> synchronize_rcu() 等正在遍历旧链的读者离开
+//   -> 改写 (dev, blockno) -> 挂到新散列链 -> refcnt 置 1 发布。
+// LRU 用时间戳近似：brelse 只原子减一并记录 lastuse，不再移动链表。
+#define NBUCKET      13
+#define BUF_EVICTING 0xffffffffU
+
 static struct {
-    struct spinlock lock;      // 保护整个缓存结构
-    struct buf      buf[NBUF]; // 实际的缓存块数组
-    struct buf      head;      // 伪头结点（不存数据，只用于链表）
+    struct mcslock lock;           // 串行化换出/重新散列
+    struct buf     buf[NBUF];      // 实际的缓存块数组
+    struct buf    *bucket[NBUCKET];
 } bcache;
 
-// 内部辅助：获取一个指定 (dev, blockno) 的 buf
+static inline uint32
+bhash(uint32 dev, uint32 blockno)
+{
+    return (dev * 31 + blockno) % NBUCKET;
+}
+
+// 无锁地钉住 b：refcnt 为 BUF_EVICTING 时失败
+static int
+bpin(struct buf *b)
+{
+    uint32 r = __atomic_load_n(&b->refcnt, __ATOMIC_RELAXED);
+    while (r != BUF_EVICTING) {
+        if (__atomic_compare_exchange_n(&b->refcnt, &r, r + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 快路径：RCU 读侧查找并钉住 (dev, blockno)，未命中返回 0
 static struct buf *
-bget(uint32 dev, uint32 blockno)
+bget_fast(uint32 dev, uint32 blockno)
 {
     struct buf *b;
 
-    acquire(&bcache.lock);
-
-    // 1. 在缓存中查找是否已经存在
-    for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+    rcu_read_lock();
+    for (b = rcu_dereference(bcache.bucket[bhash(dev, blockno)]); b != 0;
+         b = rcu_dereference(b->hnext)) {
         if (b->dev == dev && b->blockno == blockno) {
-            b->refcnt++;
-            release(&bcache.lock);
-            acquiresleep(&b->lock);
+            if (!bpin(b)) {
+                break;   // 正在被换出
+            }
+            // 钉住之前它可能已被换成别的块，复查一次
+            if (b->dev != dev || b->blockno != blockno) {
+                __atomic_fetch_sub(&b->refcnt, 1, __ATOMIC_RELEASE);
+                break;
+            }
+            rcu_read_unlock();
             return b;
         }
     }
+    rcu_read_unlock();
+    return 0;
+}
 
-    // 2. 没找到，则从 LRU 尾部找一个 refcnt == 0 的 buf 复用
-    for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-        if (b->refcnt == 0) {
-            b->dev     = dev;
-            b->blockno = blockno;
-            b->valid   = 0;
-            b->disk    = 0;
-            b->refcnt  = 1;
-
-            release(&bcache.lock);
-            acquiresleep(&b->lock);
-            return b;
+// 从散列链上摘下 b（调用者持有 bcache.lock）
+static void
+bunhash(struct buf *b)
+{
+    struct buf **pp = &bcache.bucket[bhash(b->dev, b->blockno)];
+    while (*pp != 0) {
+        if (*pp == b) {
+            rcu_assign_pointer(*pp, b->hnext);
+            return;
         }
+        pp = &(*pp)->hnext;
     }
+}
 
-    release(&bcache.lock);
-    panic("bget: no free buffer");
-    return 0;
+// 内部辅助：获取一个指定 (dev, blockno) 的 buf
+static struct buf *
+bget(uint32 dev, uint32 blockno)
+{
+    struct buf *b;
+
+    // 1. 快路径：无锁查找，多个 CPU 的命中可以并行且不写共享锁字
+    if ((b = bget_fast(dev, blockno)) != 0) {
+        acquiresleep(&b->lock);
+        return b;
+    }
+
+    // 2. 未命中：拿锁后重新查一遍（可能已被别人装入）
+    mcs_acquire(&bcache.lock);
+    if ((b = bget_fast(dev, blockno)) != 0) {
+        mcs_release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+    }
+
+    // 3. 选一个最久未使用、且能被原子标记为换出中的空闲 buf
+    for (;;) {
+        struct buf *victim = 0;
+        for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+            if (__atomic_load_n(&b->refcnt, __ATOMIC_RELAXED) == 0 &&
+                (victim == 0 || b->lastuse < victim->lastuse)) {
+                victim = b;
+            }
+        }
+        if (victim == 0) {
+            mcs_release(&bcache.lock);
+            panic("bget: no free buffer");
+        }
+
+        uint32 zero = 0;
+        if (__atomic_compare_exchange_n(&victim->refcnt, &zero, BUF_EVICTING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            b = victim;
+            break;
+        }
+        // 刚被无锁读者钉住了，换一个
+    }
+
+    // 4. 延迟回收：摘链后等宽限期结束，保证没有读者还停在旧链上
+    bunhash(b);
+    synchronize_rcu();
+
+    b->dev     = dev;
+    b->blockno = blockno;
+    b->valid   = 0;
+    b->disk    = 0;
+
+    uint32 h = bhash(dev, blockno);
+    b->hnext = bcache.bucket[h];
+    rcu_assign_pointer(bcache.bucket[h], b);
+
+    // 先发布新身份，再允许读者钉住
+    __atomic_store_n(&b->refcnt, 1, __ATOMIC_RELEASE);
+
+    mcs_release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
 }
 
 // 初始化块缓存：在内核启动时调用一次
@@ -65,25 +165,22 @@ binit(void)
 {
     struct buf *b;
 
-    initlock(&bcache.lock, "bcache");
+    initmcslock(&bcache.lock, "bcache");
 
-    // 初始化双向环形链表 head
-    bcache.head.prev = &bcache.head;
-    bcache.head.next = &bcache.head;
+    for (int i = 0; i < NBUCKET; i++) {
+        bcache.bucket[i] = 0;
+    }
 
-    // 把所有 buf 挂到 head 后面（MRU 位置）
+    // 所有 buf 初始都不对应任何块，也不在散列链上
     for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-        b->valid  = 0;
-        b->disk   = 0;
-        b->dev    = 0;
+        b->valid   = 0;
+        b->disk    = 0;
+        b->dev     = 0;
         b->blockno = 0;
-        b->refcnt = 0;
+        b->refcnt  = 0;
+        b->lastuse = 0;
+        b->hnext   = 0;
         initsleeplock(&b->lock, "buffer");
-
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
     }
 
     // 初始化底层 virtio 磁盘
@@ -98,7 +195,9 @@ bread(uint32 dev, uint32 blockno)
 
 if (!b->valid) {
     buffer_cache_misses++;
-    virtio_disk_rw(b, 0);   // 读盘
+    if (!log_read(b)) {
+        virtio_disk_rw(b, 0);   // 读盘
+    }
     b->valid = 1;
 } else {
     buffer_cache_hits++;
@@ -107,6 +206,16 @@ return b;
 
 }
 
+// 取 (dev, blockno) 对应的 buf 但不读盘：调用者马上会整块覆盖 b->data
+// （页缓存把整页写穿到数据块时用，省掉一次无用的读）
+struct buf *
+bgetblk(uint32 dev, uint32 blockno)
+{
+    struct buf *b = bget(dev, blockno);
+    b->valid = 1;
+    return b;
+}
+
 // 标记 buf 需要写入磁盘，并交给日志系统记录
 void
 bwrite(struct buf *b)
@@ -119,7 +228,7 @@ bwrite(struct buf *b)
     log_write(b);     // 记录到日志中（写前日志，只记录“哪个块会被写回”）
 }
 
-// 释放对 buf 的持有
+// 释放对 buf 的持有：只原子减引用并记录使用时间，不拿 bcache.lock
 void
 brelse(struct buf *b)
 {
@@ -129,26 +238,9 @@ brelse(struct buf *b)
 
     releasesleep(&b->lock);
 
-    acquire(&bcache.lock);
-
-    if (b->refcnt < 1) {
+    b->lastuse = r_time();
+    uint32 old = __atomic_fetch_sub(&b->refcnt, 1, __ATOMIC_RELEASE);
+    if (old < 1 || old == BUF_EVICTING) {
         panic("brelse: refcnt < 1");
     }
-
-    b->refcnt--;
-
-    // 没有使用者时，把该 buf 移动到 LRU 头部（MRU）
-    if (b->refcnt == 0) {
-        // 从当前位置摘链
-        b->next->prev = b->prev;
-        b->prev->next = b->next;
-
-        // 插入到 head 后面
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
-    }
-
-    release(&bcache.lock);
 }
@@ -0,0 +1,157 @@
+// kernel/fdt.c
+// 极简的扁平设备树（FDT）解析：只用来在启动时得到物理内存的大小。
+//
+// DTB 结构：头部之后是结构块（一串 32 位大端 token）和字符串块。
+//   FDT_BEGIN_NODE name\0(补齐到 4 字节)
+//   FDT_PROP len nameoff value(补齐到 4 字节)
+//   FDT_END_NODE / FDT_NOP / FDT_END
+// 我们顺序扫描结构块：根节点上读 #address-cells/#size-cells，
+// 第一层名字以 "memory" 开头的节点上读 reg。
+
+#include "types.h"
+#include "fdt.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE   0x2
+#define FDT_PROP       0x3
+#define FDT_NOP        0x4
+#define FDT_END        0x9
+
+struct fdt_header {
+    uint32 magic;
+    uint32 totalsize;
+    uint32 off_dt_struct;
+    uint32 off_dt_strings;
+    uint32 off_mem_rsvmap;
+    uint32 version;
+    uint32 last_comp_version;
+    uint32 boot_cpuid_phys;
+    uint32 size_dt_strings;
+    uint32 size_dt_struct;
+};
+
+uint64 boot_dtb;
+
+static uint32
+be32(const void *p)
+{
+    const uint8 *b = (const uint8 *)p;
+    return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// 读 cells 个 32 位大端 cell 组成的数（最多 2 个）
+static uint64
+read_cells(const uint8 *p, int cells)
+{
+    uint64 v = 0;
+    for (int i = 0; i < cells; i++) {
+        v = (v << 32) | be32(p + 4 * i);
+    }
+    return v;
+}
+
+static int
+str_eq(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static int
+str_prefix(const char *s, const char *prefix)
+{
+    while (*prefix) {
+        if (*s++ != *prefix++) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32
+str_len(const char *s)
+{
+    uint32 n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+#define ALIGN4(x) (((x) + 3) & ~3U)
+
+int
+fdt_memory(uint64 dtb, uint64 *base, uint64 *size)
+{
+    if (dtb == 0 || (dtb & 3) != 0) {
+        return -1;
+    }
+
+    const struct fdt_header *h = (const struct fdt_header *)dtb;
+    if (be32(&h->magic) != FDT_MAGIC) {
+        return -1;
+    }
+
+    const uint8 *st   = (const uint8 *)dtb + be32(&h->off_dt_struct);
+    const uint8 *end  = st + be32(&h->size_dt_struct);
+    const char *strs  = (const char *)dtb + be32(&h->off_dt_strings);
+
+    int depth = 0;
+    int in_memory = 0;        // 当前是否在第一层的 memory 节点里
+    int addr_cells = 2;       // 规范里的默认值
+    int size_cells = 1;
+
+    const uint8 *p = st;
+    while (p + 4 <= end) {
+        uint32 tok = be32(p);
+        p += 4;
+
+        switch (tok) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)p;
+            p += ALIGN4(str_len(name) + 1);
+            depth++;
+            in_memory = (depth == 2 && str_prefix(name, "memory"));
+            break;
+        }
+        case FDT_END_NODE:
+            depth--;
+            in_memory = 0;
+            break;
+        case FDT_PROP: {
+            uint32 len = be32(p);
+            const char *pname = strs + be32(p + 4);
+            const uint8 *val = p + 8;
+            p = val + ALIGN4(len);
+
+            if (depth == 1) {
+                if (str_eq(pname, "#address-cells") && len == 4) {
+                    addr_cells = (int)be32(val);
+                } else if (str_eq(pname, "#size-cells") && len == 4) {
+                    size_cells = (int)be32(val);
+                }
+            } else if (in_memory && str_eq(pname, "reg")) {
+                if (addr_cells < 1 || addr_cells > 2 || size_cells < 1 || size_cells > 2 ||
+                    len < (uint32)(4 * (addr_cells + size_cells))) {
+                    return -1;
+                }
+                *base = read_cells(val, addr_cells);
+                *size = read_cells(val + 4 * addr_cells, size_cells);
+                return 0;
+            }
+            break;
+        }
+        case FDT_NOP:
+            break;
+        case FDT_END:
+            return -1;
+        default:
+            return -1;   // 结构块损坏
+        }
+    }
+    return -1;
+}
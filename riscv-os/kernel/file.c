@@ -3,12 +3,15 @@
 #include "printf.h"
 #include "fs.h"
 #include "file.h"
+#include "proc.h"
 #include "stat.h"
+#include "fcntl.h"
 #include "spinlock.h"
+#include "mcslock.h"
 
 // 全局打开文件表
 static struct {
-    struct spinlock lock;
+    struct mcslock  lock;
     struct file     file[NFILE];
 } ftable;
 
@@ -16,22 +19,22 @@ static struct {
 void
 fileinit(void)
 {
-    initlock(&ftable.lock, "ftable");
+    initmcslock(&ftable.lock, "ftable");
 }
 
 // 分配一个新的 struct file
 struct file *
 filealloc(void)
 {
-    acquire(&ftable.lock);
+    mcs_acquire(&ftable.lock);
     for (int i = 0; i < NFILE; i++) {
         if (ftable.file[i].ref == 0) {
             ftable.file[i].ref = 1;
-            release(&ftable.lock);
+            mcs_release(&ftable.lock);
             return &ftable.file[i];
         }
     }
-    release(&ftable.lock);
+    mcs_release(&ftable.lock);
     return 0;
 }
 
@@ -39,13 +42,13 @@ filealloc(void)
 struct file *
 filedup(struct file *f)
 {
-    acquire(&ftable.lock);
+    mcs_acquire(&ftable.lock);
     if (f->ref < 1) {
-        release(&ftable.lock);
+        mcs_release(&ftable.lock);
         panic("filedup");
     }
     f->ref++;
-    release(&ftable.lock);
+    mcs_release(&ftable.lock);
     return f;
 }
 
@@ -55,16 +58,16 @@ fileclose(struct file *f)
 {
     struct file ff;
 
-    acquire(&ftable.lock);
+    mcs_acquire(&ftable.lock);
     if (f->ref < 1) {
-        release(&ftable.lock);
+        mcs_release(&ftable.lock);
         panic("fileclose");
     }
 
     f->ref--;
     if (f->ref > 0) {
         // 还有其它引用者，不真正关闭
-        release(&ftable.lock);
+        mcs_release(&ftable.lock);
         return;
     }
 
@@ -75,7 +78,7 @@ fileclose(struct file *f)
     f->writable = 0;
     f->ip       = 0;
     f->off      = 0;
-    release(&ftable.lock);
+    mcs_release(&ftable.lock);
 
     // 真正释放底层资源
     if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
@@ -98,10 +101,7 @@ filestat(struct file *f, uint64 addr)
     stati(f->ip, &st);
     iunlock(f->ip);
 
-    // 当前实验没有真正的用户态地址空间，直接认为 addr 是内核地址
-    struct stat *dst = (struct stat *)addr;
-    *dst = st;
-    return 0;
+    return either_copyout(1, addr, &st, sizeof(st));
 }
 
 // 读取文件内容
@@ -136,15 +136,24 @@ filewrite(struct file *f, uint64 addr, int n)
         return -1;
     }
 
+    // 一个事务写多少：写穿的内容按日志容量切（没对齐时多跨一页）；
+    // 普通文件写时不记日志，只按限流的粒度切，好在两段之间 writeback_balance
+    int chunk;
+    if (f->ip->type == T_FILE) {
+        chunk = (WB_DIRTY_LIMIT - WB_DIRTY_BACKGROUND) * BSIZE;
+    } else {
+        chunk = (log_op_max() - 5) * BSIZE;
+    }
+
     int tot = 0;
 
     while (tot < n) {
         int n1 = n - tot;
-        if (n1 > MAXOPBLOCKS * BSIZE) {
-            n1 = MAXOPBLOCKS * BSIZE;
+        if (n1 > chunk) {
+            n1 = chunk;
         }
 
-        begin_op();
+        begin_op_n(writei_budget(f->ip, f->off, n1));
         ilock(f->ip);
         int r = writei(f->ip, 1 /* user_src */, addr + tot, f->off, n1);
         if (r > 0) {
@@ -152,6 +161,7 @@ filewrite(struct file *f, uint64 addr, int n)
         }
         iunlock(f->ip);
         end_op();
+        writeback_balance();   // 脏页太多时自己先写一部分
 
         if (r < 0) {
             return -1;
@@ -164,3 +174,205 @@ filewrite(struct file *f, uint64 addr, int n)
 
     return (tot == n) ? n : -1;
 }
+
+// 一次 ilock 读完所有段，某段读不满（到文件末尾）就停下
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt, int64 off)
+{
+    if (!f->readable) {
+        return -1;
+    }
+    if (f->type != FD_INODE && f->type != FD_DEVICE) {
+        return -1;
+    }
+
+    int tot = 0;
+    ilock(f->ip);
+    uint32 o = off < 0 ? f->off : (uint32)off;
+    for (int i = 0; i < iovcnt; i++) {
+        int r = readi(f->ip, 1 /* user_dst */, iov[i].iov_base, o, (uint32)iov[i].iov_len);
+        if (r < 0) {
+            if (tot == 0) {
+                tot = -1;
+            }
+            break;
+        }
+        o   += r;
+        tot += r;
+        if ((uint64)r != iov[i].iov_len) {
+            break;
+        }
+    }
+    if (off < 0 && tot > 0) {
+        f->off = o;
+    }
+    iunlock(f->ip);
+    return tot;
+}
+
+// 整个向量在同一个事务、同一次 ilock 里写完，中途不会插进别人的写
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt, int64 off)
+{
+    if (!f->writable) {
+        return -1;
+    }
+    if (f->type != FD_INODE && f->type != FD_DEVICE) {
+        return -1;
+    }
+
+    // 各段在文件里是连续的，预算按整段范围算；放不进一个事务的向量拒绝
+    uint32 o = off < 0 ? f->off : (uint32)off;
+    uint64 len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    int budget = writei_budget(f->ip, o, (uint32)len);
+    if (budget > log_op_max()) {
+        return -1;
+    }
+
+    int tot = 0;
+    begin_op_n(budget);
+    ilock(f->ip);
+    for (int i = 0; i < iovcnt; i++) {
+        int r = writei(f->ip, 1 /* user_src */, iov[i].iov_base, o, (uint32)iov[i].iov_len);
+        if (r < 0) {
+            if (tot == 0) {
+                tot = -1;
+            }
+            break;
+        }
+        o   += r;
+        tot += r;
+        if ((uint64)r != iov[i].iov_len) {
+            break;
+        }
+    }
+    if (off < 0 && tot > 0) {
+        f->off = o;
+    }
+    iunlock(f->ip);
+    end_op();
+    writeback_balance();
+    return tot;
+}
+
+// 两个 inode 按地址顺序加锁，避免两个方向相反的拷贝互相等
+static void
+ilock_two(struct inode *a, struct inode *b)
+{
+    if (a == b) {
+        ilock(a);
+    } else if (a < b) {
+        ilock(a);
+        ilock(b);
+    } else {
+        ilock(b);
+        ilock(a);
+    }
+}
+
+static void
+iunlock_two(struct inode *a, struct inode *b)
+{
+    iunlock(a);
+    if (a != b) {
+        iunlock(b);
+    }
+}
+
+// 数据不经过用户缓冲区：源文件的页缓存页直接写进目标文件的页缓存。
+// 目标只能是普通文件，写时不记日志，按限流粒度切成几个事务，段间 writeback_balance
+int
+filecopy(struct file *in, uint32 *inoff, struct file *out, uint32 *outoff, int n)
+{
+    if (!in->readable || !out->writable || n < 0) {
+        return -1;
+    }
+    if (in->type != FD_INODE || out->type != FD_INODE ||
+        in->ip->type != T_FILE || out->ip->type != T_FILE) {
+        return -1;
+    }
+
+    uint32 *ip_off = inoff  ? inoff  : &in->off;
+    uint32 *op_off = outoff ? outoff : &out->off;
+
+    // 同一个文件里重叠的范围不拷（和 Linux 一样）
+    if (in->ip == out->ip &&
+        (uint64)*ip_off < (uint64)*op_off + n && (uint64)*op_off < (uint64)*ip_off + n) {
+        return -1;
+    }
+
+    int chunk = (WB_DIRTY_LIMIT - WB_DIRTY_BACKGROUND) * BSIZE;
+    int tot = 0;
+
+    while (tot < n) {
+        int n1 = n - tot;
+        if (n1 > chunk) {
+            n1 = chunk;
+        }
+
+        begin_op_n(writei_budget(out->ip, *op_off, n1));
+        ilock_two(in->ip, out->ip);
+        int r = copyi(in->ip, *ip_off, out->ip, *op_off, n1);
+        *ip_off += r;
+        *op_off += r;
+        iunlock_two(in->ip, out->ip);
+        end_op();
+        writeback_balance();
+
+        tot += r;
+        if (r < n1) {
+            break;   // 源文件读完了，或者内存不足
+        }
+    }
+    return tot;
+}
+
+// 让 dst 变成 src 的克隆（reflink）：两者共享数据块，谁先写谁复制。
+// src 的脏页先写回，共享的必须是磁盘上的最新内容
+int
+filereflink(struct file *src, struct file *dst)
+{
+    if (!src->readable || !dst->writable) {
+        return -1;
+    }
+    if (src->type != FD_INODE || dst->type != FD_INODE || src->ip == dst->ip) {
+        return -1;
+    }
+
+    writeback_inode(src->ip);
+
+    begin_op();
+    ilock_two(src->ip, dst->ip);
+    int r = ireflink(src->ip, dst->ip);
+    if (r == 0) {
+        dst->off = 0;
+    }
+    iunlock_two(src->ip, dst->ip);
+    end_op();
+    return r;
+}
+
+// fallocate：mode 为 0 或 FALLOC_FL_KEEP_SIZE 时预分配，
+// FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE 时打洞
+int
+filefallocate(struct file *f, int mode, uint32 off, uint32 len)
+{
+    if (!f->writable || f->type != FD_INODE || len == 0) {
+        return -1;
+    }
+    int punch = mode == (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE);
+    if (!punch && mode != 0 && mode != FALLOC_FL_KEEP_SIZE) {
+        return -1;
+    }
+
+    begin_op();
+    ilock(f->ip);
+    int r = punch ? ipunch(f->ip, off, len)
+                  : iprealloc(f->ip, off, len, mode & FALLOC_FL_KEEP_SIZE);
+    iunlock(f->ip);
+    end_op();
+    return r;
+}
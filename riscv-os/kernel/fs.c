@@ -1,6 +1,6 @@
 // kernel/fs.c
 // 简化版 xv6 风格文件系统实现：
-//  - 物理块分配/释放（balloc/bfree）
+//  - 物理块分配/释放（balloc/bfree），reflink 共享块的计数（bref/brefcount）
 //  - inode 分配/缓存/读写（ialloc/iget/ilock/...）
 //  - 文件读写（readi/writei）
 //  - 目录与路径解析（dirlookup/namei/...）
@@ -11,6 +11,8 @@
 #include "fs.h"
 #include "stat.h"
 #include "file.h"   // 为了调用 fileinit()
+#include "rcu.h"
+#include "proc.h"   // either_copyin/either_copyout
 
 // 超级块全局变量（内存中的 copy）
 struct superblock sb;
@@ -118,10 +120,81 @@ balloc(uint32 dev)
     return 0;
 }
 
-// 把块 bno 标记为空闲
+// 预分配用：找一段最多 want 块的连续空闲块，标成已用但不清零——
+// 这些块以“未写入”（BUNWRITTEN）挂到文件上，读的时候当洞，第一次写回时整块覆盖。
+// 够长的一段找不到就用最长的一段（不跨位图块）。返回起始块号，*got 是块数，磁盘满了 *got 为 0
+static uint32
+balloc_run(uint32 dev, uint32 want, uint32 *got)
+{
+    uint32 best = 0, bestn = 0;
+
+    for (uint32 bno = 0; bno < sb.size && bestn < want; bno += BPB) {
+        struct buf *b = bread(dev, BBLOCK(bno, sb));
+        unsigned char *bits = (unsigned char *)b->data;
+
+        for (uint32 bi = 0; bi < BPB && bno + bi < sb.size && bestn < want; ) {
+            uint32 n = 0;
+            while (n < want && bi + n < BPB && bno + bi + n < sb.size &&
+                   (bits[(bi + n) / 8] & (1 << ((bi + n) % 8))) == 0) {
+                n++;
+            }
+            if (n > bestn) {
+                best  = bno + bi;
+                bestn = n;
+            }
+            bi += n + 1;   // 第 n 位是已用的（或者到头了）
+        }
+        brelse(b);
+    }
+
+    if (bestn > 0) {
+        struct buf *b = bread(dev, BBLOCK(best, sb));
+        unsigned char *bits = (unsigned char *)b->data;
+        for (uint32 i = 0; i < bestn; i++) {
+            uint32 bi = (best + i) % BPB;
+            bits[bi / 8] |= 1 << (bi % 8);
+        }
+        bwrite(b);
+        brelse(b);
+    }
+    *got = bestn;
+    return best;
+}
+
+// 块 bno 除了第一个引用者以外还被几个文件共享
+uint32
+brefcount(uint32 dev, uint32 bno)
+{
+    struct buf *b = bread(dev, RBLOCK(bno, sb));
+    uint32 n = ((uint16 *)b->data)[bno % RPB];
+    brelse(b);
+    return n;
+}
+
+// 给块 bno 的共享计数加 delta（reflink 时 +1，共享者释放时 -1）
+static void
+bref(uint32 dev, uint32 bno, int delta)
+{
+    struct buf *b = bread(dev, RBLOCK(bno, sb));
+    uint16 *cnt = (uint16 *)b->data + (bno % RPB);
+
+    if ((delta > 0 && *cnt == 0xffff) || (delta < 0 && *cnt == 0)) {
+        panic("bref: bad share count");
+    }
+    *cnt += delta;
+    bwrite(b);
+    brelse(b);
+}
+
+// 放掉对块 bno 的一个引用：还有别的文件共享时只减计数，最后一个引用才真正清位图
 static void
 bfree(uint32 dev, uint32 bno)
 {
+    if (brefcount(dev, bno) > 0) {
+        bref(dev, bno, -1);
+        return;
+    }
+
     struct buf *b = bread(dev, BBLOCK(bno, sb));
     char *bits = (char *)b->data;
 
@@ -139,7 +212,8 @@ bfree(uint32 dev, uint32 bno)
     brelse(b);
 }
 
-// bmap：逻辑块号 bn -> 物理块号（alloc=1 时需要则分配）
+// bmap：逻辑块号 bn -> 物理块号（alloc=1 时需要则分配）。
+// 预分配还没写过的块带着 BUNWRITTEN 标记原样返回
 static uint32
 bmap(struct inode *ip, uint32 bn, int alloc)
 {
@@ -152,6 +226,7 @@ bmap(struct inode *ip, uint32 bn, int alloc)
         if (addr == 0 && alloc) {
             addr = balloc(ip->dev);
             ip->addrs[bn] = addr;
+            ip->idirty = 1;
         }
         return addr;
     }
@@ -169,6 +244,7 @@ bmap(struct inode *ip, uint32 bn, int alloc)
         }
         addr = balloc(ip->dev);
         ip->addrs[NDIRECT] = addr;
+        ip->idirty = 1;
     }
 
     b = bread(ip->dev, addr);
@@ -183,53 +259,156 @@ bmap(struct inode *ip, uint32 bn, int alloc)
     return result;
 }
 
+// 把第 bn 块的块号（可能带 BUNWRITTEN）改成 entry，需要时分配间接块。
+// 间接块从不共享（reflink 时给新文件复制了一份），直接改。调用者持有 ip->lock 且在事务里
+static void
+bmap_set(struct inode *ip, uint32 bn, uint32 entry)
+{
+    if (bn < NDIRECT) {
+        ip->addrs[bn] = entry;
+        ip->idirty = 1;
+        return;
+    }
+
+    if (ip->addrs[NDIRECT] == 0) {
+        ip->addrs[NDIRECT] = balloc(ip->dev);
+        ip->idirty = 1;
+    }
+    struct buf *b = bread(ip->dev, ip->addrs[NDIRECT]);
+    ((uint32 *)b->data)[bn - NDIRECT] = entry;
+    bwrite(b);
+    brelse(b);
+}
+
+// bmap 的对外版本（页缓存用），返回值可能带 BUNWRITTEN。调用者持有 ip->lock；alloc 时还要在事务里
+uint32
+ibmap(struct inode *ip, uint32 bn, int alloc)
+{
+    return bmap(ip, bn, alloc);
+}
+
+// 要整块写入第 bn 块时用：没有就分配；和别的文件共享着（reflink）就写时复制——
+// 换一块新的，旧块只减共享计数；预分配的未写入块原地转成普通块。
+// 调用者马上整块覆盖，不用拷旧内容。
+// 调用者持有 ip->lock 且在事务里
+uint32
+ibmap_write(struct inode *ip, uint32 bn)
+{
+    uint32 entry = bmap(ip, bn, 1);
+    uint32 addr  = BADDR(entry);
+
+    if (brefcount(ip->dev, addr) > 0) {
+        uint32 fresh = balloc(ip->dev);
+        bmap_set(ip, bn, fresh);
+        bref(ip->dev, addr, -1);
+        return fresh;
+    }
+    if (entry & BUNWRITTEN) {
+        bmap_set(ip, bn, addr);   // 预分配的块第一次写：去掉标记，块号不变
+    }
+    return addr;
+}
+
 // ------------ inode 缓存 & 初始化 ------------
 
 // 初始化 inode 缓存
 void
 iinit(void)
 {
-    initlock(&icache.lock, "icache");
+    initmcslock(&icache.lock, "icache");
     for (int i = 0; i < NINODE; i++) {
         icache.inode[i].ref   = 0;
         icache.inode[i].valid = 0;
+        pcache_truncate(&icache.inode[i], 0);   // 重新初始化时丢掉旧缓存（磁盘已经重建）
+        icache.inode[i].pc.pinned    = 0;
+        icache.inode[i].idirty       = 0;
+        icache.inode[i].sync_seq     = 0;
+        icache.inode[i].datasync_seq = 0;
         initsleeplock(&icache.inode[i].lock, "inode");
     }
 }
 
+// 快路径：RCU 读侧无锁查找 (dev, inum)，命中则把 ref 原子加一后返回。
+// 只有 ref>0 的项可以被钉住；ref==0 的空闲槽只会在持有 icache.lock 时
+// 被改写身份，而且是先写 (dev, inum) 再发布 ref=1，所以钉住后复查一次
+// 身份即可识别“槽位已被复用”的情况。icache 是固定数组，没有链表，
+// 读者不会因为槽位被复用而走丢，无需等待宽限期。
+static struct inode *
+iget_fast(uint32 dev, uint32 inum)
+{
+    struct inode *ip;
+
+    rcu_read_lock();
+    for (ip = icache.inode; ip < icache.inode + NINODE; ip++) {
+        if (ip->dev != dev || ip->inum != inum) {
+            continue;
+        }
+        int r = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED);
+        while (r > 0) {
+            if (__atomic_compare_exchange_n(&ip->ref, &r, r + 1, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        if (r <= 0) {
+            continue;   // 空闲槽，钉不住
+        }
+        rcu_read_unlock();
+
+        if (ip->dev != dev || ip->inum != inum) {
+            // 钉住之前槽位已被复用：放掉多拿的引用，走慢路径
+            iput(ip);
+            return 0;
+        }
+        return ip;
+    }
+    rcu_read_unlock();
+    return 0;
+}
+
 // 从缓存中获取一个指定 (dev, inum) 的 inode
 struct inode *
 iget(uint32 dev, uint32 inum)
 {
     struct inode *ip, *empty = 0;
 
-    acquire(&icache.lock);
+    // 1. 快路径：命中时只有一次原子加一，不碰 icache.lock
+    if ((ip = iget_fast(dev, inum)) != 0) {
+        return ip;
+    }
 
-    // 1. 在缓存中查找
+    // 2. 未命中：拿锁后重新查找（可能已被别人装入），顺便记下一个空闲项。
+    //    ref==0 但身份相同、内容仍有效的槽直接复活，它的页缓存也接着用
+    mcs_acquire(&icache.lock);
     for (ip = icache.inode; ip < icache.inode + NINODE; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
-            release(&icache.lock);
+        if (ip->dev == dev && ip->inum == inum &&
+            (ip->ref > 0 || ip->valid)) {
+            __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
+            mcs_release(&icache.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0) {
-            empty = ip;
+        if (ip->ref == 0 && (empty == 0 || (empty->pc.nrpages > 0 && ip->pc.nrpages == 0))) {
+            empty = ip;   // 优先挑没有缓存页的空闲槽
         }
     }
 
-    // 2. 没有命中缓存，则找一个空闲项
+    // 3. 没有命中缓存，则找一个空闲项
     if (empty == 0) {
-        release(&icache.lock);
+        mcs_release(&icache.lock);
         panic("iget: no free inode");
     }
 
+    // ref==0 的槽只有持锁者能改，先写身份再发布 ref
     ip = empty;
+    pcache_truncate(ip, 0);   // 旧身份的缓存页不能带给新 inode
     ip->dev   = dev;
     ip->inum  = inum;
-    ip->ref   = 1;
     ip->valid = 0;
+    ip->sync_seq     = 0;
+    ip->datasync_seq = 0;
+    __atomic_store_n(&ip->ref, 1, __ATOMIC_RELEASE);
 
-    release(&icache.lock);
+    mcs_release(&icache.lock);
     return ip;
 }
 
@@ -289,7 +468,8 @@ ilock(struct inode *ip)
         }
 
         brelse(b);
-        ip->valid = 1;
+        ip->valid  = 1;
+        ip->idirty = 0;
 
         if (ip->type == T_UNUSED) {
             panic("ilock: no type");
@@ -325,17 +505,33 @@ iupdate(struct inode *ip)
 
     bwrite(b);
     brelse(b);
+
+    // size/addrs 变了的话，fdatasync 也得等这一批
+    ip->sync_seq = log.seq;
+    if (ip->idirty) {
+        ip->datasync_seq = log.seq;
+    }
+    ip->idirty = 0;
 }
 
 // 释放 inode 的引用，当 ref==1 且 nlink==0 时会删除文件内容
 void
 iput(struct inode *ip)
 {
-    acquire(&icache.lock);
+    // 快路径：不是最后一个引用，原子减一即可
+    int r = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED);
+    while (r > 1) {
+        if (__atomic_compare_exchange_n(&ip->ref, &r, r - 1, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+
+    mcs_acquire(&icache.lock);
 
     if (ip->ref == 1 && ip->valid && ip->nlink == 0) {
         // 准备删除：释放磁盘上所有数据块并清空 inode
-        release(&icache.lock);
+        mcs_release(&icache.lock);
 
         ilock(ip);
         itrunc(ip);
@@ -343,12 +539,13 @@ iput(struct inode *ip)
         iupdate(ip);
         iunlock(ip);
 
-        acquire(&icache.lock);
+        mcs_acquire(&icache.lock);
         ip->valid = 0;
     }
 
-    ip->ref--;
-    release(&icache.lock);
+    // 无锁读者可能同时在加一，这里也必须用原子操作
+    __atomic_fetch_sub(&ip->ref, 1, __ATOMIC_RELEASE);
+    mcs_release(&icache.lock);
 }
 
 // 释放一个 inode 占用的所有数据块
@@ -358,7 +555,7 @@ itrunc(struct inode *ip)
     // 直接块
     for (int i = 0; i < NDIRECT; i++) {
         if (ip->addrs[i]) {
-            bfree(ip->dev, ip->addrs[i]);
+            bfree(ip->dev, BADDR(ip->addrs[i]));
             ip->addrs[i] = 0;
         }
     }
@@ -369,7 +566,7 @@ itrunc(struct inode *ip)
         uint32 *a = (uint32 *)b->data;
         for (int i = 0; i < NINDIRECT; i++) {
             if (a[i]) {
-                bfree(ip->dev, a[i]);
+                bfree(ip->dev, BADDR(a[i]));
             }
         }
         brelse(b);
@@ -377,7 +574,9 @@ itrunc(struct inode *ip)
         ip->addrs[NDIRECT] = 0;
     }
 
+    pcache_truncate(ip, 0);
     ip->size = 0;
+    ip->idirty = 1;
     iupdate(ip);
 }
 
@@ -386,8 +585,6 @@ itrunc(struct inode *ip)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint32 off, uint32 n)
 {
-    (void)user_dst; // 当前没有真正的用户地址空间，直接把 dst 当成内核指针
-
     if (off > ip->size || off + n < off) {
         return 0;
     }
@@ -404,14 +601,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint32 off, uint32 n)
             m = n - tot;
         }
 
-        uint32 addr = bmap(ip, bn, 0);
-        if (addr == 0) {
-            panic("readi: addr == 0");
+        // 命中页缓存时不用 bmap、不碰块缓存
+        char *page = pcache_get(ip, bn, 1);
+        if (page == 0) {
+            return -1;   // 内存不足
+        }
+        if (either_copyout(user_dst, dst + tot, page + boff, m) < 0) {
+            return -1;   // 用户地址无效
         }
-
-        struct buf *b = bread(ip->dev, addr);
-        memmove_local((void *)(dst + tot), b->data + boff, m);
-        brelse(b);
 
         tot += m;
         off += m;
@@ -420,17 +617,67 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint32 off, uint32 n)
     return n;
 }
 
+// writei(ip, .., off, n) 最多往日志里记多少块，用作 begin_op_n 的预算。
+// 普通文件写时只改页缓存，一块都不记；目录内容写穿，每页一块，
+// 再加 inode、间接块和最多两个位图块
 int
-writei(struct inode *ip, int user_src, uint64 src, uint32 off, uint32 n)
+writei_budget(struct inode *ip, uint32 off, uint32 n)
 {
-    (void)user_src;
+    if (ip->type == T_FILE || n == 0) {
+        return 0;
+    }
+    return (int)((off + n - 1) / BSIZE - off / BSIZE + 1) + 4;
+}
 
-    if (off > ip->size || off + n < off) {
+// 把 [off, off+n)（在同一页里）清零。没缓存、也没有写过的块（洞或预分配）的页本来就读成 0，不用动。
+// 调用者持有 ip->lock
+static int
+izero(struct inode *ip, uint32 off, uint32 n)
+{
+    uint32 bn = off / BSIZE;
+    uint32 entry = bmap(ip, bn, 0);
+    if (pcache_lookup(ip, bn) == 0 && (entry == 0 || (entry & BUNWRITTEN))) {
+        return 0;
+    }
+
+    char *page = pcache_get(ip, bn, 1);
+    if (page == 0) {
         return -1;
     }
-    if (off + n > MAXFILE * BSIZE) {
+    for (uint32 i = 0; i < n; i++) {
+        page[off % BSIZE + i] = 0;
+    }
+    pcache_set_dirty(ip, bn);
+    return 0;
+}
+
+// 文件要从 ip->size 长到 newsize：原来最后一页末尾之外可能有 mmap 写进去的内容，
+// 现在成了文件的一部分，先清零
+static int
+izero_tail(struct inode *ip, uint32 newsize)
+{
+    uint32 tail = ip->size % BSIZE;
+    if (tail == 0 || newsize <= ip->size) {
+        return 0;
+    }
+    uint32 gap = newsize - ip->size;
+    return izero(ip, ip->size, gap < BSIZE - tail ? gap : BSIZE - tail);
+}
+
+// 先写页缓存。普通文件只打脏标记，块的分配和落盘都推迟到写回（writeback.c），
+// size 变了也只记 idirty；目录内容是元数据，仍然整页写穿到磁盘块（经日志）。
+// 普通文件可以写到末尾之后，中间留下的洞不分配块，读出来是 0
+int
+writei(struct inode *ip, int user_src, uint64 src, uint32 off, uint32 n)
+{
+    if (off + n < off || off + n > MAXFILE * BSIZE) {
         return -1;
     }
+    if (off > ip->size) {
+        if (ip->type != T_FILE || izero_tail(ip, off) < 0) {
+            return -1;
+        }
+    }
 
     uint32 tot = 0;
     while (tot < n) {
@@ -441,15 +688,27 @@ writei(struct inode *ip, int user_src, uint64 src, uint32 off, uint32 n)
             m = n - tot;
         }
 
-        uint32 addr = bmap(ip, bn, 1);
-        if (addr == 0) {
-            panic("writei: addr == 0");
+        // 整页覆盖时不必先从磁盘读旧内容
+        int cached = pcache_lookup(ip, bn) != 0;
+        char *page = pcache_get(ip, bn, m != BSIZE);
+        if (page == 0) {
+            break;
+        }
+        if (either_copyin(page + boff, user_src, src + tot, m) < 0) {
+            // 用户地址无效：这一页可能写了一半。刚装入的页丢掉（磁盘上的还是对的），
+            // 原来就在缓存里的页可能本来就脏，只能留着当作写了一半
+            if (cached) {
+                pcache_set_dirty(ip, bn);
+            } else {
+                pcache_drop(ip, bn, bn + 1);
+            }
+            break;
+        }
+        if (ip->type == T_FILE) {
+            pcache_set_dirty(ip, bn);
+        } else {
+            pcache_write_page(ip, bn);
         }
-
-        struct buf *b = bread(ip->dev, addr);
-        memmove_local(b->data + boff, (void *)(src + tot), m);
-        bwrite(b);
-        brelse(b);
 
         tot += m;
         off += m;
@@ -457,9 +716,213 @@ writei(struct inode *ip, int user_src, uint64 src, uint32 off, uint32 n)
 
     if (off > ip->size) {
         ip->size = off;
+        ip->idirty = 1;
     }
-    iupdate(ip);
-    return n;
+    if (ip->type != T_FILE) {
+        iupdate(ip);
+    }
+    return tot;
+}
+
+// 把 src 从 soff 开始的 n 字节拷到 dst 的 doff（copy_file_range/sendfile）。
+// 源页从页缓存里直接交给 writei，整页对齐的部分目标页也不用先读盘，
+// 全程只有一次内存拷贝。调用者持有两个 inode 的锁。返回拷了多少字节
+int
+copyi(struct inode *src, uint32 soff, struct inode *dst, uint32 doff, uint32 n)
+{
+    if (soff >= src->size) {
+        return 0;
+    }
+    if (n > src->size - soff) {
+        n = src->size - soff;
+    }
+
+    uint32 tot = 0;
+    while (tot < n) {
+        uint32 boff = soff % BSIZE;
+        uint32 m    = BSIZE - boff;
+        if (m > (n - tot)) {
+            m = n - tot;
+        }
+
+        // src 被引用着，dst 的 pcache_get 回收缓存时不会拿走这一页
+        char *page = pcache_get(src, soff / BSIZE, 1);
+        if (page == 0) {
+            break;
+        }
+        int r = writei(dst, 0, (uint64)(page + boff), doff, m);
+        if (r > 0) {
+            tot  += r;
+            soff += r;
+            doff += r;
+        }
+        if (r != (int)m) {
+            break;
+        }
+    }
+    return tot;
+}
+
+// 在 [off, off+len) 打洞（fallocate 的 PUNCH_HOLE）：文件大小不变，这段读出来是 0。
+// 整页的部分连同缓存页一起丢掉、释放磁盘块（共享块只减计数），间接块空了也释放；
+// 两头不满一页的部分在缓存里清零，照常写回。打到文件末尾时最后不满的一页也整页释放。
+// 调用者持有 ip->lock 且在事务里
+int
+ipunch(struct inode *ip, uint32 off, uint32 len)
+{
+    if (ip->type != T_FILE || off + len < off) {
+        return -1;
+    }
+    uint32 end = off + len < ip->size ? off + len : ip->size;
+    if (off >= end) {
+        return 0;
+    }
+
+    uint32 first = (off + BSIZE - 1) / BSIZE;   // 第一个整页
+    uint32 last  = end == ip->size ? (end + BSIZE - 1) / BSIZE : end / BSIZE;
+    if (first >= last) {
+        return izero(ip, off, end - off);   // 落在同一页里
+    }
+    if (off < first * BSIZE && izero(ip, off, first * BSIZE - off) < 0) {
+        return -1;
+    }
+    if (last * BSIZE < end && izero(ip, last * BSIZE, end - last * BSIZE) < 0) {
+        return -1;
+    }
+
+    pcache_drop(ip, first, last);
+
+    for (uint32 bn = first; bn < last && bn < NDIRECT; bn++) {
+        if (ip->addrs[bn]) {
+            bfree(ip->dev, BADDR(ip->addrs[bn]));
+            ip->addrs[bn] = 0;
+            ip->idirty = 1;
+        }
+    }
+
+    if (last > NDIRECT && ip->addrs[NDIRECT]) {
+        struct buf *b = bread(ip->dev, ip->addrs[NDIRECT]);
+        uint32 *a = (uint32 *)b->data;
+        int changed = 0, left = 0;
+        for (uint32 i = 0; i < NINDIRECT; i++) {
+            if (a[i] && NDIRECT + i >= first && NDIRECT + i < last) {
+                bfree(ip->dev, BADDR(a[i]));
+                a[i] = 0;
+                changed = 1;
+            }
+            left |= a[i] != 0;
+        }
+        if (left) {
+            if (changed) {
+                bwrite(b);
+            }
+            brelse(b);
+        } else {
+            brelse(b);
+            bfree(ip->dev, ip->addrs[NDIRECT]);
+            ip->addrs[NDIRECT] = 0;
+            ip->idirty = 1;
+        }
+    }
+
+    if (ip->idirty) {
+        iupdate(ip);   // 和位图的改动在同一个事务里
+    }
+    return 0;
+}
+
+// 预分配 [off, off+len)（fallocate 的 mode 0 / KEEP_SIZE）：还没有块的页各挂一个
+// 未写入块（BUNWRITTEN），尽量连续，不清零、不进页缓存；读的时候当洞，
+// 写回时原地整块覆盖并去掉标记。之后往这段里写只剩数据块本身，不再改位图、不再清零。
+// keep_size 为 0 时文件大小扩到 off+len。磁盘满了返回 -1（已经挂上的块留着）。
+// 调用者持有 ip->lock 且在事务里
+int
+iprealloc(struct inode *ip, uint32 off, uint32 len, int keep_size)
+{
+    if (ip->type != T_FILE || off + len < off || off + len > MAXFILE * BSIZE) {
+        return -1;
+    }
+
+    int r = 0;
+    uint32 last = (off + len + BSIZE - 1) / BSIZE;
+    for (uint32 bn = off / BSIZE; bn < last; bn++) {
+        if (bmap(ip, bn, 0) != 0) {
+            continue;
+        }
+        uint32 n = 1;   // 这段洞有多长
+        while (bn + n < last && bmap(ip, bn + n, 0) == 0) {
+            n++;
+        }
+        uint32 got;
+        uint32 start = balloc_run(ip->dev, n, &got);
+        if (got == 0) {
+            r = -1;
+            break;
+        }
+        for (uint32 i = 0; i < got; i++) {
+            bmap_set(ip, bn + i, (start + i) | BUNWRITTEN);
+        }
+        bn += got - 1;
+    }
+
+    if (r == 0 && !keep_size && off + len > ip->size) {
+        if (izero_tail(ip, off + len) < 0) {
+            r = -1;
+        } else {
+            ip->size = off + len;
+            ip->idirty = 1;
+        }
+    }
+    if (ip->idirty) {
+        iupdate(ip);   // 和位图的改动在同一个事务里
+    }
+    return r;
+}
+
+// 让 dst 变成 src 的克隆：先丢掉 dst 原来的内容，再让它引用 src 的全部数据块，
+// 每个块的共享计数加一；间接块给 dst 复制一份，不共享。
+// 之后谁先写某一块，谁在写回时换新块（ibmap_write）。
+// src 必须已经写回（延迟分配的页还不在磁盘上）。调用者持有两个锁且在事务里
+int
+ireflink(struct inode *src, struct inode *dst)
+{
+    if (src == dst || src->type != T_FILE || dst->type != T_FILE) {
+        return -1;
+    }
+    if (src->pc.nrdirty > 0) {
+        return -1;
+    }
+
+    itrunc(dst);
+
+    for (int i = 0; i < NDIRECT; i++) {
+        if (src->addrs[i]) {
+            bref(src->dev, BADDR(src->addrs[i]), 1);
+            dst->addrs[i] = src->addrs[i];
+        }
+    }
+
+    if (src->addrs[NDIRECT]) {
+        uint32 ind = balloc(dst->dev);
+        struct buf *sbuf = bread(src->dev, src->addrs[NDIRECT]);
+        struct buf *db  = bread(dst->dev, ind);
+        uint32 *a = (uint32 *)sbuf->data;
+        for (uint32 j = 0; j < NINDIRECT; j++) {
+            if (a[j]) {
+                bref(src->dev, BADDR(a[j]), 1);
+            }
+        }
+        memmove_local(db->data, sbuf->data, BSIZE);
+        bwrite(db);
+        brelse(db);
+        brelse(sbuf);
+        dst->addrs[NDIRECT] = ind;
+    }
+
+    dst->size = src->size;
+    dst->idirty = 1;
+    iupdate(dst);
+    return 0;
 }
 
 // ------------ stat 信息 ------------
@@ -678,11 +1141,13 @@ nameiparent(char *path, char *name)
 void
 fs_init(int dev)
 {
+
     // 1. 初始化块缓存（内部会 virtio_disk_init 创建 RAM 磁盘 + superblock）
     binit();
 
-    // 2. 初始化全局文件表
+    // 2. 初始化全局文件表和 fd 表
     fileinit();
+    sysfileinit();
 
     // 3. 读取超级块
     readsb(dev, &sb);
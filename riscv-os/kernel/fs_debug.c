@@ -44,11 +44,18 @@ calc_nbitmap(void)
     return (sb.size + BPB - 1) / BPB;
 }
 
-// 计算 data 区起始块号：bitmap 之后就是 data blocks
+// 计算共享计数区有多少块
+static uint32
+calc_nrefblocks(void)
+{
+    return (sb.size + RPB - 1) / RPB;
+}
+
+// 计算 data 区起始块号：bitmap、共享计数区之后就是 data blocks
 static uint32
 calc_datastart(void)
 {
-    return sb.bmapstart + calc_nbitmap();
+    return sb.bmapstart + calc_nbitmap() + calc_nrefblocks();
 }
 
 // 扫描 bitmap，统计 data 区空闲块数量
@@ -125,6 +132,13 @@ debug_filesystem_state(void)
 
     printf("Buffer cache hits  : %u\n", buffer_cache_hits);
     printf("Buffer cache misses: %u\n", buffer_cache_misses);
+    printf("Page cache hits    : %lu\n", pcache_hits);
+    printf("Page cache misses  : %lu\n", pcache_misses);
+    printf("Page cache pages   : %lu\n", pcache_pages);
+    printf("Page cache dirty   : %lu\n", pcache_dirty);
+    printf("Writeback pages    : %lu\n", writeback_pages);
+    printf("Writeback runs     : %lu\n", writeback_runs);
+    printf("Log commits        : %lu\n", log_commits);
 
     debug_disk_io();
 }
@@ -133,7 +147,8 @@ debug_filesystem_state(void)
 //
 // 检查点：
 // 1) inode 引用的数据块是否越界 / 是否落入 metadata 区（非法）
-// 2) 是否出现 “同一个块被多个 inode 引用”（重复引用）
+// 2) 每个块被引用的次数必须等于 1 + 共享计数（reflink 克隆出来的块合法地被多处引用，
+//    计数对不上就是重复引用或者计数泄漏）
 // 3) inode 引用的块，在 bitmap 中必须是 allocated
 //
 // 返回 0 表示 OK；返回 -1 表示发现问题（会打印具体错误）
@@ -142,13 +157,16 @@ fsck_lite(void)
 {
     printf("=== fsck_lite: start ===\n");
 
+    // 延迟分配的块还没落盘，先写回，检查的才是完整的磁盘状态
+    writeback_sync();
+
     uint32 dev = ROOTDEV;
     uint32 datastart = calc_datastart();
 
     // 为了简单：假设 fs size 不会超过 4096 blocks（你现在是 1024）
     // 如果未来扩展，可改成动态分配或增大常量。
     enum { FSCK_MAXBLOCKS = 4096 };
-    static unsigned char used[FSCK_MAXBLOCKS];
+    static uint32 used[FSCK_MAXBLOCKS];   // 每个块被引用的次数
 
     if (sb.size > FSCK_MAXBLOCKS) {
         printf("fsck_lite: WARNING: sb.size=%u > %u, check range truncated.\n",
@@ -156,7 +174,7 @@ fsck_lite(void)
     }
 
     uint32 limit = (sb.size < FSCK_MAXBLOCKS) ? sb.size : (uint32)FSCK_MAXBLOCKS;
-    memset_local(used, 0, limit);
+    memset_local(used, 0, limit * sizeof(used[0]));
 
     int errors = 0;
 
@@ -186,13 +204,9 @@ fsck_lite(void)
                 errors++;
                 return;
             }
-            if (used[addr]) {
-                printf("fsck_lite ERROR: duplicate block %u referenced again (inode %u %s)\n",
-                       addr, inum, what);
-                errors++;
-                return;
+            if (used[addr]++) {
+                return;   // 共享块：位图已经查过，次数最后统一核对
             }
-            used[addr] = 1;
 
             // 位图一致性：引用的块必须在 bitmap 中是 1
             if (bitmap_isset(dev, addr) == 0) {
@@ -204,7 +218,7 @@ fsck_lite(void)
 
         // 直接块
         for (int i = 0; i < NDIRECT; i++) {
-            check_addr(dip->addrs[i], "direct");
+            check_addr(BADDR(dip->addrs[i]), "direct");
         }
 
         // 一级间接块：dip->addrs[NDIRECT] 指向间接块本身
@@ -215,7 +229,7 @@ fsck_lite(void)
             uint32 *a = (uint32 *)ib->data;
             for (int j = 0; j < NINDIRECT; j++) {
                 if (a[j]) {
-                    check_addr(a[j], "indirect(data)");
+                    check_addr(BADDR(a[j]), "indirect(data)");
                 }
             }
             brelse(ib);
@@ -224,6 +238,19 @@ fsck_lite(void)
         brelse(b);
     }
 
+    // 引用次数 vs 共享计数
+    for (uint32 addr = datastart; addr < limit; addr++) {
+        uint32 shared = brefcount(dev, addr);
+        if (used[addr] == 0 && shared == 0) {
+            continue;
+        }
+        if (used[addr] != 1 + shared) {
+            printf("fsck_lite ERROR: block %u referenced %u times but share count is %u\n",
+                   addr, used[addr], shared);
+            errors++;
+        }
+    }
+
     if (errors == 0) {
         printf("=== fsck_lite: OK ===\n");
         return 0;
@@ -3,6 +3,8 @@
 #include "types.h"
 #include "printf.h"
 #include "fs.h"      // struct logheader / struct log / LOGSIZE 等
+#include "riscv.h"   // r_time
+#include "pagecache.h"  // writeback_kick
 
 // 低层磁盘读写接口（在 virtio_disk.c 中实现）
 extern void virtio_disk_rw(struct buf *b, int write);
@@ -32,6 +34,17 @@ memmove_local(void *dst, const void *src, uint32 n)
     return dst;
 }
 
+uint64 log_commits = 0;   // 真正提交（写日志头 + 安装）的次数
+
+// 日志区能容纳多少个块：第一块是日志头，后面才是数据块；
+// 块号表也得放得进日志头
+static int
+log_capacity(void)
+{
+    int n = log.size - 1;
+    return n < (int)LOGMAXBLOCKS ? n : (int)LOGMAXBLOCKS;
+}
+
 // 从磁盘读取日志头到内存 log.lh
 static void
 read_head(void)
@@ -40,7 +53,7 @@ read_head(void)
     struct logheader *hd = (struct logheader *)(b->data);
 
     log.lh.n = hd->n;
-    if (log.lh.n < 0 || log.lh.n > LOGSIZE) {
+    if (log.lh.n < 0 || log.lh.n > log_capacity()) {
         panic("read_head: bad n");
     }
     for (int i = 0; i < log.lh.n; i++) {
@@ -111,32 +124,30 @@ initlog(int dev, struct superblock *sb)
 {
     log.dev   = dev;
     log.start = sb->logstart;
-    log.size  = sb->nlog;
+    log.size  = sb->nlog;   // 日志多大由超级块决定
+    if (log_capacity() < MAXOPBLOCKS) {
+        panic("initlog: log too small");
+    }
 
     log.outstanding = 0;
     log.committing  = 0;
     log.lh.n        = 0;
+    log.since       = 0;
+    log.reserved    = 0;
+    log.seq         = 1;   // inode 里的 0 表示“没有要等的批次”
 
     printf("log: init: start=%d, size=%d\n", log.start, log.size);
 
     recover_from_log();
 }
 
-// 开始一个文件系统操作
-void
-begin_op(void)
-{
-    if (log.committing) {
-        panic("begin_op: committing");
-    }
-    log.outstanding++;
-}
-
 // 真正执行一次提交
 static void
 commit(void)
 {
     if (log.lh.n > 0) {
+        log.committing = 1;
+
         // 1) 把日志头写到磁盘，标记“日志有效”
         write_head();
 
@@ -146,10 +157,51 @@ commit(void)
         // 3) 清空日志头并写回磁盘，表示“事务已经完成”
         log.lh.n = 0;
         write_head();
+
+        log.committing = 0;
+        log.seq++;
+        log_commits++;
     }
 }
 
-// 结束一次文件系统操作
+// 一个操作最多能预留多少块
+int
+log_op_max(void)
+{
+    return log_capacity();
+}
+
+// 开始一个最多修改 nblocks 个块的文件系统操作。
+// 组提交：之前结束的操作可能还攒在日志里没提交，
+// 再加上这次的预算放不下时，先把攒着的提交掉。
+// 内核不可抢占，操作之间不会交错，还有操作没结束时放不下只能是预算算错了
+void
+begin_op_n(int nblocks)
+{
+    if (log.committing) {
+        panic("begin_op: committing");
+    }
+    if (nblocks > log_capacity()) {
+        panic("begin_op: budget exceeds log");
+    }
+    if (log.lh.n + log.reserved + nblocks > log_capacity()) {
+        if (log.outstanding > 0) {
+            panic("begin_op: log full");
+        }
+        commit();
+    }
+    log.reserved += nblocks;
+    log.outstanding++;
+}
+
+void
+begin_op(void)
+{
+    begin_op_n(MAXOPBLOCKS);
+}
+
+// 结束一次文件系统操作：不再立刻提交，攒到日志快满、
+// 写回线程觉得够老了、或者有人 fsync 时再一起提交
 void
 end_op(void)
 {
@@ -159,25 +211,60 @@ end_op(void)
 
     log.outstanding--;
     if (log.outstanding == 0) {
-        // 当前没有别的文件系统操作在进行，可以安全提交
-        log.committing = 1;
-        commit();
-        log.committing = 0;
+        log.reserved = 0;   // 预留的块要么用掉了（在 lh.n 里），要么不再需要
+        if (log.lh.n > 0) {
+            writeback_kick();
+        }
+    }
+}
+
+// 立刻提交攒着的事务（sync/写回线程用）。
+// 还有操作没结束时不能提交，返回 -1
+int
+log_force(void)
+{
+    if (log.outstanding > 0) {
+        return -1;
     }
+    commit();
+    return 0;
+}
+
+// 保证第 seq 批已经落盘（fsync/fdatasync 用）：它已经提交过了就什么都不做，
+// 否则它只能是正在攒的这一批，提交掉
+int
+log_force_seq(uint64 seq)
+{
+    if (seq < log.seq || log.lh.n == 0) {
+        return 0;
+    }
+    return log_force();
+}
+
+// b 的块在还没提交的日志里时，从日志区读出最新内容，返回 1；否则返回 0。
+// bread 未命中时先问这里：已经 log_write、还没安装的块在原位置上是旧的
+int
+log_read(struct buf *b)
+{
+    if (b->dev != (uint32)log.dev || log.committing) {
+        return 0;
+    }
+    for (int i = 0; i < log.lh.n; i++) {
+        if ((uint32)log.lh.block[i] == b->blockno) {
+            struct buf *lb = bread(log.dev, log.start + 1 + i);
+            memmove_local(b->data, lb->data, BSIZE);
+            brelse(lb);
+            return 1;
+        }
+    }
+    return 0;
 }
 
 // 把一个即将被修改的缓冲区 b 纳入日志系统
 void
 log_write(struct buf *b)
 {
-    // 如果不在事务内，直接“裸写”到磁盘，不占用日志空间。
-    // 这里一定不能调用 bwrite()，否则会回到 log_write 形成递归。
-    if (log.outstanding < 1) {
-        virtio_disk_rw(b, 1);
-        return;
-    }
-
-    // 查找该块是否已经在当前事务的日志列表中
+    // 查找该块是否已经在攒着的事务里（吸收：同一块改多次只占一个日志块）
     int i;
     for (i = 0; i < log.lh.n; i++) {
         if ((uint32)log.lh.block[i] == b->blockno) {
@@ -185,11 +272,24 @@ log_write(struct buf *b)
         }
     }
 
+    // 如果不在事务内，直接“裸写”到磁盘，不占用日志空间；
+    // 但它要是还在日志里，日志里那份也得跟着更新，否则提交时会被旧内容盖掉。
+    // 这里一定不能调用 bwrite()，否则会回到 log_write 形成递归。
+    if (log.outstanding < 1) {
+        virtio_disk_rw(b, 1);
+        if (i == log.lh.n) {
+            return;
+        }
+    }
+
     if (i == log.lh.n) {
         // 这是一个新的块记录
-        if (log.lh.n >= log.size || log.lh.n >= LOGSIZE) {
+        if (log.lh.n >= log_capacity()) {
             panic("log_write: log full");
         }
+        if (log.lh.n == 0) {
+            log.since = r_time();
+        }
         log.lh.block[i] = b->blockno;
         log.lh.n++;
     }
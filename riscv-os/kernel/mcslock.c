@@ -0,0 +1,121 @@
+// kernel/mcslock.c
+// MCS 队列锁实现，用于 bcache/icache/ftable 这类热点全局锁。
+
+#include "types.h"
+#include "riscv.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "mcslock.h"
+
+// 已注册的 MCS 锁，只用于 debug_mcslock_stats()
+#define NMCSTAB 32
+
+static struct mcslock *mcstab[NMCSTAB];
+static int nmcstab = 0;
+
+void
+initmcslock(struct mcslock *lk, char *name)
+{
+    lk->name        = name;
+    lk->tail        = 0;
+    lk->cpu         = 0;
+    lk->nacquire    = 0;
+    lk->ncontended  = 0;
+    lk->spin_cycles = 0;
+    for (int i = 0; i < NCPU; i++) {
+        lk->node[i].next   = 0;
+        lk->node[i].locked = 0;
+    }
+
+    for (int i = 0; i < nmcstab; i++) {
+        if (mcstab[i] == lk) {
+            return;
+        }
+    }
+    if (nmcstab < NMCSTAB) {
+        mcstab[nmcstab++] = lk;
+    }
+}
+
+void
+mcs_acquire(struct mcslock *lk)
+{
+    push_off();
+
+    if (mcs_holding(lk)) {
+        panic("mcs_acquire: already holding");
+    }
+
+    struct mcs_node *me = &lk->node[cpuid()];
+    me->next   = 0;
+    me->locked = 1;
+
+    // 把自己挂到队尾；前驱为空说明锁是空闲的，直接拿到
+    struct mcs_node *pred = __atomic_exchange_n(&lk->tail, me, __ATOMIC_ACQ_REL);
+
+    uint64 t0 = 0;
+    if (pred) {
+        t0 = r_time();
+        __atomic_store_n(&pred->next, me, __ATOMIC_RELEASE);
+
+        // 只在自己的节点上自旋，等前驱在释放时把 locked 清零
+        while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE)) {
+            // busy wait
+        }
+    }
+
+    lk->cpu = mycpu();
+    lk->nacquire++;
+    if (pred) {
+        lk->ncontended++;
+        lk->spin_cycles += r_time() - t0;
+    }
+}
+
+void
+mcs_release(struct mcslock *lk)
+{
+    if (!mcs_holding(lk)) {
+        panic("mcs_release: not holding");
+    }
+
+    struct mcs_node *me = &lk->node[cpuid()];
+    lk->cpu = 0;
+
+    struct mcs_node *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if (next == 0) {
+        // 没有已知的后继：尝试把队尾从自己改回空
+        struct mcs_node *expected = me;
+        if (__atomic_compare_exchange_n(&lk->tail, &expected, 0, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            pop_off();
+            return;
+        }
+        // 有人刚把自己挂到队尾，等它填好 me->next
+        while ((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == 0) {
+            // busy wait
+        }
+    }
+
+    // 直接把锁交给后继
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+int
+mcs_holding(struct mcslock *lk)
+{
+    return lk->tail != 0 && lk->cpu == mycpu();
+}
+
+void
+debug_mcslock_stats(void)
+{
+    printf("=== MCS Lock Statistics ===\n");
+    for (int i = 0; i < nmcstab; i++) {
+        struct mcslock *lk = mcstab[i];
+        printf("%s: acquires=%lu contended=%lu spin_cycles=%lu\n",
+               lk->name, lk->nacquire, lk->ncontended, lk->spin_cycles);
+    }
+}
@@ -0,0 +1,398 @@
+// kernel/mmap.c
+// 文件映射 mmap / munmap / msync
+//
+//  - 每个用户进程有 NVMA 个 vma 槽位，映射区从 USERTOP 往下分配（p->mmapbase），
+//    sbrk 不能把堆长进映射区；
+//  - mmap 只登记 vma，不读文件；第一次访问时缺页，由 vma_fault 装入；
+//  - 装入时直接把该文件页缓存里的那一页映射进用户页表（页引用计数加一），
+//    读文件不再经过 readi 的复制，read()/write() 和映射看到的是同一页；
+//  - MAP_SHARED：写入直接落在页缓存里，脏页（PTE_D）在 msync/munmap/退出时
+//    标成页缓存脏页，由写回线程落盘；msync 还会当场写回并提交日志；
+//  - MAP_PRIVATE：先只读地映射页缓存页，第一次写时换成私有拷贝，永不写回。
+
+#include "types.h"
+#include "memlayout.h"
+#include "printf.h"
+#include "riscv.h"
+#include "pmm.h"
+#include "vm.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+static void
+copy_page(char *dst, const char *src)
+{
+  for (int i = 0; i < PGSIZE; i++) {
+    dst[i] = src[i];
+  }
+}
+
+// 一个空闲的 vma 槽位，没有返回 0
+static struct vma *
+vma_alloc(struct proc *p)
+{
+  for (int i = 0; i < NVMA; i++) {
+    if (p->vmas[i].end == 0) {
+      return &p->vmas[i];
+    }
+  }
+  return 0;
+}
+
+// 映射区下界 = 现存映射里最低的起点
+static void
+vma_update_base(struct proc *p)
+{
+  uint64 base = USERTOP;
+  for (int i = 0; i < NVMA; i++) {
+    if (p->vmas[i].end != 0 && p->vmas[i].start < base) {
+      base = p->vmas[i].start;
+    }
+  }
+  p->mmapbase = base;
+}
+
+struct vma *
+vma_lookup(struct proc *p, uint64 va)
+{
+  for (int i = 0; i < NVMA; i++) {
+    struct vma *v = &p->vmas[i];
+    if (v->end != 0 && va >= v->start && va < v->end) {
+      return v;
+    }
+  }
+  return 0;
+}
+
+// 建立映射：len 向上取整到页，off 必须页对齐。返回映射起点，失败返回 -1
+uint64
+mmap_region(struct proc *p, uint64 len, int prot, int flags,
+            struct file *f, uint64 off)
+{
+  if (len == 0 || len > USERTOP || (off % PGSIZE) != 0) {
+    return (uint64)-1;
+  }
+  // RISC-V 没有“只写”页，映射必须可读
+  if ((prot & PROT_READ) == 0 || (prot & ~(PROT_READ | PROT_WRITE)) != 0) {
+    return (uint64)-1;
+  }
+  if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+    return (uint64)-1;
+  }
+  if (f->type != FD_INODE || !f->readable || f->ip->type != T_FILE) {
+    return (uint64)-1;
+  }
+  if (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable) {
+    return (uint64)-1;
+  }
+
+  len = PGROUNDUP(len);
+  if (len > p->mmapbase || p->mmapbase - len < PGROUNDUP(p->sz)) {
+    return (uint64)-1;   // 会和堆重叠
+  }
+
+  struct vma *v = vma_alloc(p);
+  if (v == 0) {
+    return (uint64)-1;
+  }
+
+  v->start = p->mmapbase - len;
+  v->end   = p->mmapbase;
+  v->prot  = prot;
+  v->flags = flags;
+  v->file  = filedup(f);
+  v->off   = off;
+  p->mmapbase = v->start;
+  return v->start;
+}
+
+// MAP_SHARED 的页被写过（PTE_D）时把对应的页缓存页标脏，并清掉 D 位。
+// 映射的就是页缓存页，真正落盘交给写回；文件已经被截断、这一页不再在缓存里时不管。
+// 返回是否标了脏页。调用者负责事后刷 TLB（否则 TLB 里 D=1 的项不会再把 D 位写回 PTE）。
+static int
+vma_writeback(struct vma *v, uint64 va, pte_t *pte)
+{
+  if (v->flags != MAP_SHARED || (*pte & PTE_W) == 0 || (*pte & PTE_D) == 0) {
+    return 0;
+  }
+
+  uint64 off = v->off + (va - v->start);
+  struct inode *ip = v->file->ip;
+  int dirty = 0;
+
+  ilock(ip);
+  if (off < ip->size && (uint64)pcache_lookup(ip, off / PGSIZE) == PTE_PA(*pte)) {
+    pcache_set_dirty(ip, off / PGSIZE);
+    dirty = 1;
+  }
+  iunlock(ip);
+
+  *pte &= ~PTE_D;
+  return dirty;
+}
+
+// 拆掉 v 中 [start, end) 已装入的页，MAP_SHARED 的脏页先标到页缓存里
+static void
+vma_unmap_pages(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  int dirty = 0;
+
+  for (uint64 va = start; va < end; va += PGSIZE) {
+    pte_t *pte = walk(p->pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0) {
+      continue;   // 还没碰过
+    }
+    dirty |= vma_writeback(v, va, pte);
+    free_page((void *)PTE_PA(*pte));   // 页缓存页只是少一个引用
+    *pte = 0;
+  }
+  proc_tlb_flush(p, (uint64)-1);
+  if (dirty) {
+    writeback_kick();
+  }
+}
+
+// 页缓存要丢掉 ip 的第 [from, to) 页（截断、打洞）之前，拆掉所有进程里
+// 直接映射着这些缓存页的 PTE（类似 Linux 的 unmap_mapping_range）。
+// 否则 MAP_SHARED 之后的写落在已经不属于文件的页上，悄悄丢失。
+// 拆掉后再访问重新缺页：洞读成 0，文件末尾之外的访问失败。
+// MAP_PRIVATE 已经换成私有拷贝的页不是缓存页，不动。调用者持有 ip->lock
+void
+vma_zap_range(struct inode *ip, uint64 from, uint64 to)
+{
+  for (struct proc *p = procs; p < procs + NPROC; p++) {
+    if (p->state == PROC_UNUSED || p->pagetable == 0) {
+      continue;
+    }
+    int zapped = 0;
+    for (int i = 0; i < NVMA; i++) {
+      struct vma *v = &p->vmas[i];
+      if (v->end == 0 || v->file->ip != ip) {
+        continue;
+      }
+      uint64 vfrom = v->off / PGSIZE;
+      uint64 vto   = vfrom + (v->end - v->start) / PGSIZE;
+      uint64 lo = from > vfrom ? from : vfrom;
+      uint64 hi = to < vto ? to : vto;
+      for (uint64 pg = lo; pg < hi; pg++) {
+        pte_t *pte = walk(p->pagetable, v->start + (pg - vfrom) * PGSIZE, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0) {
+          continue;
+        }
+        uint64 pa = PTE_PA(*pte);
+        if (pa != (uint64)pcache_lookup(ip, (uint32)pg)) {
+          continue;   // 私有拷贝
+        }
+        free_page((void *)pa);
+        *pte = 0;
+        zapped = 1;
+      }
+    }
+    if (zapped) {
+      proc_tlb_flush(p, (uint64)-1);
+    }
+  }
+}
+
+// 拆掉 [addr, addr+len)：只能去掉某个映射的开头、结尾或者整段，不能在中间挖洞
+int
+munmap_region(struct proc *p, uint64 addr, uint64 len)
+{
+  if ((addr % PGSIZE) != 0 || len == 0) {
+    return -1;
+  }
+  len = PGROUNDUP(len);
+
+  struct vma *v = vma_lookup(p, addr);
+  if (v == 0 || addr + len > v->end || addr + len < addr) {
+    return -1;
+  }
+  if (addr != v->start && addr + len != v->end) {
+    return -1;
+  }
+
+  vma_unmap_pages(p, v, addr, addr + len);
+
+  if (addr == v->start && addr + len == v->end) {
+    struct file *f = v->file;
+    v->end  = 0;
+    v->file = 0;
+    fileclose(f);
+  } else if (addr == v->start) {
+    v->off  += len;
+    v->start = addr + len;
+  } else {
+    v->end = addr;
+  }
+  vma_update_base(p);
+  return 0;
+}
+
+// 把 [addr, addr+len) 里 MAP_SHARED 的脏页写回文件并提交日志，映射保持不变
+int
+msync_region(struct proc *p, uint64 addr, uint64 len)
+{
+  if ((addr % PGSIZE) != 0 || addr + len < addr) {
+    return -1;
+  }
+  uint64 end = PGROUNDUP(addr + len);
+  int found = 0, err = 0;
+
+  for (int i = 0; i < NVMA; i++) {
+    struct vma *v = &p->vmas[i];
+    if (v->end == 0 || v->end <= addr || v->start >= end) {
+      continue;
+    }
+    found = 1;
+    uint64 lo = v->start > addr ? v->start : addr;
+    uint64 hi = v->end < end ? v->end : end;
+    for (uint64 va = lo; va < hi; va += PGSIZE) {
+      pte_t *pte = walk(p->pagetable, va, 0);
+      if (pte && (*pte & PTE_V)) {
+        vma_writeback(v, va, pte);
+      }
+    }
+    if (v->flags == MAP_SHARED && writeback_fsync(v->file->ip, 1) < 0) {
+      err = 1;
+    }
+  }
+  if (found) {
+    proc_tlb_flush(p, (uint64)-1);
+  }
+  return found && !err ? 0 : -1;
+}
+
+// 映射区缺页。成功返回 0（调用者负责刷该 va 的 TLB），越界/权限不符/内存不足返回 -1
+int
+vma_fault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  uint64 va0 = PGROUNDDOWN(va);
+
+  if (write && (v->prot & PROT_WRITE) == 0) {
+    return -1;
+  }
+
+  pte_t *pte = walk(p->pagetable, va0, 0);
+  if (pte && (*pte & PTE_V)) {
+    if (!write) {
+      return 0;   // copyin 之类先一步装好了
+    }
+    if (*pte & PTE_W) {
+      // 硬件不自动维护 A/D 位时，第一次写可写页也会陷进来
+      *pte |= PTE_A | PTE_D;
+      return 0;
+    }
+    if (*pte & PTE_COW) {
+      return uvm_cow_fault(p->pagetable, va0);
+    }
+
+    // MAP_PRIVATE 只读映射着页缓存页：第一次写时换成私有拷贝
+    char *mem = (char *)alloc_page_tag(MT_USER);
+    if (mem == 0) {
+      return -1;
+    }
+    uint64 pa = PTE_PA(*pte);
+    copy_page(mem, (const char *)pa);
+    *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W | PTE_A | PTE_D;
+    proc_tlb_flush(p, va0);   // copyout 路径不会替我们刷
+    free_page((void *)pa);
+    return 0;
+  }
+
+  uint64 off = v->off + (va0 - v->start);
+  struct inode *ip = v->file->ip;
+
+  ilock(ip);
+  if (off >= ip->size) {
+    iunlock(ip);
+    return -1;   // 整页都在文件末尾之外
+  }
+  char *page = pcache_get(ip, off / PGSIZE, 1);
+  if (page == 0) {
+    iunlock(ip);
+    return -1;
+  }
+
+  // 私有映射上的写直接给一份拷贝；其它情况映射页缓存页本身
+  uint64 pa;
+  uint64 perm = PTE_R | PTE_U | PTE_A;
+  if (v->flags == MAP_PRIVATE && write) {
+    char *mem = (char *)alloc_page_tag(MT_USER);
+    if (mem == 0) {
+      iunlock(ip);
+      return -1;
+    }
+    copy_page(mem, page);
+    pa = (uint64)mem;
+    perm |= PTE_W | PTE_D;
+  } else {
+    pa = (uint64)page;
+    page_ref_inc(page);
+    if (v->flags == MAP_SHARED && (v->prot & PROT_WRITE)) {
+      perm |= PTE_W;
+      if (write) {
+        perm |= PTE_D;
+      }
+    }
+  }
+  iunlock(ip);
+
+  if (map_page(p->pagetable, va0, pa, perm) < 0) {
+    free_page((void *)pa);
+    return -1;
+  }
+  return 0;
+}
+
+// fork：子进程继承全部映射（各自持有文件引用）和已经装入的页。
+// MAP_SHARED 的页（页缓存页）两边原样共享；MAP_PRIVATE 的私有拷贝改成写时复制，
+// 只读的页缓存页原样共享。调用者负责刷父进程的 TLB。
+int
+vma_fork(struct proc *p, struct proc *np)
+{
+  for (int i = 0; i < NVMA; i++) {
+    struct vma *v = &p->vmas[i];
+    if (v->end == 0) {
+      continue;
+    }
+    np->vmas[i] = *v;
+    filedup(v->file);
+
+    for (uint64 va = v->start; va < v->end; va += PGSIZE) {
+      pte_t *pte = walk(p->pagetable, va, 0);
+      if (pte == 0 || (*pte & PTE_V) == 0) {
+        continue;
+      }
+      if (v->flags == MAP_PRIVATE && (*pte & PTE_W)) {
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      }
+      uint64 pa = PTE_PA(*pte);
+      uint64 flags = PTE_FLAGS(*pte) & ~(PTE_V | PTE_D);
+      if (map_page(np->pagetable, va, pa, flags) < 0) {
+        return -1;   // 已经建好的映射由 vma_exit(np) 收拾
+      }
+      page_ref_inc((void *)pa);
+    }
+  }
+  return 0;
+}
+
+// 进程退出：写回并拆掉所有映射，放掉文件引用
+void
+vma_exit(struct proc *p)
+{
+  for (int i = 0; i < NVMA; i++) {
+    struct vma *v = &p->vmas[i];
+    if (v->end == 0) {
+      continue;
+    }
+    vma_unmap_pages(p, v, v->start, v->end);
+    struct file *f = v->file;
+    v->end  = 0;
+    v->file = 0;
+    fileclose(f);
+  }
+  p->mmapbase = USERTOP;
+}
@@ -0,0 +1,354 @@
+// kernel/pagecache.c
+// 文件数据页缓存：每个 inode 一棵按页号索引的基数树（见 pagecache.h）。
+//
+// readi 命中缓存时直接从缓存页复制，不调用 bmap、不碰块缓存；
+// 未命中时通过块缓存读一次磁盘块填满整页（BSIZE == PGSIZE，一页正好一块）。
+// writei 只改缓存页并打上脏标记，磁盘块到写回时才分配、才写（writeback.c）。
+// 脏标记像 Linux 的 radix tree tag 一样逐层记在结点的位图里，
+// 写回时可以跳过整棵干净的子树。
+// mmap 直接把缓存页映射给用户，页引用计数保证拆映射之前页不会被真正释放。
+
+#include "types.h"
+#include "memlayout.h"
+#include "printf.h"
+#include "riscv.h"
+#include "pmm.h"
+#include "slab.h"
+#include "fs.h"
+#include "fs_debug.h"
+#include "pagecache.h"
+#include "mman.h"
+
+#if BSIZE != PGSIZE
+#error "pagecache.c: one cached page must map exactly one disk block"
+#endif
+
+#define PC_MASK (PC_SLOTS - 1)
+
+struct pc_node {
+    void  *slots[PC_SLOTS];   // 中间层指向下一层结点，最底层指向数据页
+    uint64 dirty;             // 第 i 位：第 i 个槽是脏页 / 子树里有脏页
+    uint32 count;             // 非空槽数
+};
+
+uint64 pcache_hits = 0;
+uint64 pcache_misses = 0;
+uint64 pcache_pages = 0;      // 所有 inode 缓存的页数之和
+uint64 pcache_dirty = 0;      // 其中的脏页数
+
+static struct kmem_cache *pc_node_cache;
+
+static void
+copy_page(char *dst, const char *src)
+{
+    for (int i = 0; i < PGSIZE; i++) {
+        dst[i] = src[i];
+    }
+}
+
+// 结点释放回 slab 时一定是空的，构造一次清零即可
+static void
+pc_node_ctor(void *obj)
+{
+    struct pc_node *n = (struct pc_node *)obj;
+    for (int i = 0; i < PC_SLOTS; i++) {
+        n->slots[i] = 0;
+    }
+    n->dirty = 0;
+    n->count = 0;
+}
+
+static struct pc_node *
+pc_node_alloc(void)
+{
+    // fs_init 在 slab_init 之前就会跑，cache 推迟到第一次用时再建
+    if (pc_node_cache == 0) {
+        pc_node_cache = kmem_cache_create("pc_node", sizeof(struct pc_node), 0,
+                                          pc_node_ctor);
+        if (pc_node_cache == 0) {
+            return 0;
+        }
+    }
+    return (struct pc_node *)kmem_cache_alloc(pc_node_cache);
+}
+
+// 高度 h 的树能覆盖的页数
+static uint64
+pc_capacity(int height)
+{
+    return height == 0 ? 0 : 1UL << (PC_SHIFT * height);
+}
+
+char *
+pcache_lookup(struct inode *ip, uint32 index)
+{
+    struct pcache *pc = &ip->pc;
+    if (index >= pc_capacity(pc->height)) {
+        return 0;
+    }
+
+    struct pc_node *n = pc->root;
+    for (int h = pc->height - 1; h > 0 && n != 0; h--) {
+        n = n->slots[(index >> (PC_SHIFT * h)) & PC_MASK];
+    }
+    return n ? (char *)n->slots[index & PC_MASK] : 0;
+}
+
+// 把 page 放到第 index 个槽，树不够高就在顶上加层。失败返回 -1
+// （已经建好的空结点留在树里，truncate 时一起释放）
+static int
+pc_insert(struct pcache *pc, uint32 index, char *page)
+{
+    while (index >= pc_capacity(pc->height)) {
+        struct pc_node *n = pc_node_alloc();
+        if (n == 0) {
+            return -1;
+        }
+        if (pc->root) {
+            n->slots[0] = pc->root;
+            n->count = 1;
+        }
+        pc->root = n;
+        pc->height++;
+    }
+
+    struct pc_node *n = pc->root;
+    for (int h = pc->height - 1; h > 0; h--) {
+        void **slot = &n->slots[(index >> (PC_SHIFT * h)) & PC_MASK];
+        if (*slot == 0) {
+            if ((*slot = pc_node_alloc()) == 0) {
+                return -1;
+            }
+            n->count++;
+        }
+        n = *slot;
+    }
+
+    n->slots[index & PC_MASK] = page;
+    n->count++;
+    pc->nrpages++;
+    __atomic_fetch_add(&pcache_pages, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// 释放高度为 h、从页号 base 开始的结点 n 中页号在 [from, to) 的页，返回 n 是否已经空了
+static int
+pc_truncate_node(struct pcache *pc, struct pc_node *n, int h, uint64 base,
+                 uint64 from, uint64 to)
+{
+    uint64 span = 1UL << (PC_SHIFT * (h - 1));   // 一个槽覆盖的页数
+
+    for (int i = 0; i < PC_SLOTS; i++) {
+        void *s = n->slots[i];
+        uint64 lo = base + i * span;
+        if (s == 0 || lo + span <= from || lo >= to) {
+            continue;
+        }
+        if (h == 1) {
+            if (n->dirty & (1UL << i)) {
+                pc->nrdirty--;
+                __atomic_fetch_sub(&pcache_dirty, 1, __ATOMIC_RELAXED);
+            }
+            free_page(s);   // 还被 mmap 映射着时只是少一个引用
+            pc->nrpages--;
+            __atomic_fetch_sub(&pcache_pages, 1, __ATOMIC_RELAXED);
+        } else if (pc_truncate_node(pc, (struct pc_node *)s, h - 1, lo, from, to)) {
+            kmem_cache_free(pc_node_cache, s);
+        } else {
+            if (((struct pc_node *)s)->dirty == 0) {
+                n->dirty &= ~(1UL << i);
+            }
+            continue;
+        }
+        n->slots[i] = 0;
+        n->dirty &= ~(1UL << i);
+        n->count--;
+    }
+    return n->count == 0;
+}
+
+static void
+pc_truncate_range(struct pcache *pc, uint64 from, uint64 to)
+{
+    if (pc->root && pc_truncate_node(pc, pc->root, pc->height, 0, from, to)) {
+        kmem_cache_free(pc_node_cache, pc->root);
+        pc->root = 0;
+        pc->height = 0;
+    }
+}
+
+// 丢页之前先拆掉用户对这些页的映射，映射着的页不会留在文件之外继续被写
+void
+pcache_truncate(struct inode *ip, uint32 from)
+{
+    vma_zap_range(ip, from, (uint64)-1);
+    pc_truncate_range(&ip->pc, from, (uint64)-1);
+}
+
+void
+pcache_drop(struct inode *ip, uint32 from, uint32 to)
+{
+    vma_zap_range(ip, from, to);
+    pc_truncate_range(&ip->pc, from, to);
+}
+
+// 页缓存超过上限时，把没人引用的 inode 的缓存整个丢掉。
+// 持有 icache.lock 时 ref==0 的 inode 不会被别人复活，可以不拿它的 sleeplock
+static void
+pcache_reclaim(struct inode *self)
+{
+    mcs_acquire(&icache.lock);
+    for (struct inode *ip = icache.inode; ip < icache.inode + NINODE; ip++) {
+        if (__atomic_load_n(&pcache_pages, __ATOMIC_RELAXED) < PCACHE_MAX_PAGES) {
+            break;
+        }
+        if (ip != self && ip->ref == 0 && ip->pc.nrpages > 0) {
+            pcache_truncate(ip, 0);
+        }
+    }
+    mcs_release(&icache.lock);
+}
+
+char *
+pcache_get(struct inode *ip, uint32 index, int fill)
+{
+    char *page = pcache_lookup(ip, index);
+    if (page) {
+        pcache_hits++;
+        return page;
+    }
+    pcache_misses++;
+
+    if (__atomic_load_n(&pcache_pages, __ATOMIC_RELAXED) >= PCACHE_MAX_PAGES) {
+        pcache_reclaim(ip);
+    }
+
+    page = (char *)alloc_page_tag(MT_PAGECACHE);
+    if (page == 0) {
+        return 0;
+    }
+
+    uint32 addr = fill ? ibmap(ip, index, 0) : 0;
+    if (addr != 0 && (addr & BUNWRITTEN) == 0) {   // 洞和预分配的块读成 0
+        // 经过块缓存读：日志里还没落到原位置的新内容只在块缓存里
+        struct buf *b = bread(ip->dev, addr);
+        copy_page(page, (const char *)b->data);
+        brelse(b);
+    } else {
+        for (int i = 0; i < PGSIZE; i++) {
+            page[i] = 0;
+        }
+    }
+
+    if (pc_insert(&ip->pc, index, page) < 0) {
+        free_page(page);
+        return 0;
+    }
+    return page;
+}
+
+void
+pcache_set_dirty(struct inode *ip, uint32 index)
+{
+    struct pcache *pc = &ip->pc;
+    if (index >= pc_capacity(pc->height)) {
+        panic("pcache_set_dirty: page not cached");
+    }
+
+    struct pc_node *n = pc->root;
+    for (int h = pc->height - 1; h > 0; h--) {
+        int i = (index >> (PC_SHIFT * h)) & PC_MASK;
+        n->dirty |= 1UL << i;
+        n = n->slots[i];
+    }
+    int i = index & PC_MASK;
+    if (n->slots[i] == 0) {
+        panic("pcache_set_dirty: page not cached");
+    }
+    if (n->dirty & (1UL << i)) {
+        return;
+    }
+    n->dirty |= 1UL << i;
+    pc->nrdirty++;
+    __atomic_fetch_add(&pcache_dirty, 1, __ATOMIC_RELAXED);
+
+    // 第一次变脏：替写回拿一个引用，保证写回之前 inode 不会被换出 icache
+    if (!pc->pinned) {
+        pc->pinned = 1;
+        pc->dirtied_when = r_time();
+        __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// 在以 n 为根（高度 h、从页号 base 开始）的子树里找页号 >= start 的第一个脏页，
+// 清掉沿途的脏标记后返回页号；没有返回 -1
+static int64
+pc_take_dirty(struct pc_node *n, int h, uint64 base, uint64 start)
+{
+    uint64 span = 1UL << (PC_SHIFT * (h - 1));
+
+    for (int i = 0; i < PC_SLOTS; i++) {
+        uint64 lo = base + i * span;
+        if ((n->dirty & (1UL << i)) == 0 || lo + span <= start) {
+            continue;
+        }
+        if (h == 1) {
+            n->dirty &= ~(1UL << i);
+            return (int64)lo;
+        }
+        struct pc_node *child = (struct pc_node *)n->slots[i];
+        int64 r = pc_take_dirty(child, h - 1, lo, start);
+        if (child->dirty == 0) {
+            n->dirty &= ~(1UL << i);
+        }
+        if (r >= 0) {
+            return r;
+        }
+    }
+    return -1;
+}
+
+int
+pcache_writeback(struct inode *ip, int max)
+{
+    struct pcache *pc = &ip->pc;
+    uint64 start = 0;
+    int n = 0;
+
+    while (n < max && pc->root != 0) {
+        int64 index = pc_take_dirty(pc->root, pc->height, 0, start);
+        if (index < 0) {
+            break;
+        }
+        pc->nrdirty--;
+        __atomic_fetch_sub(&pcache_dirty, 1, __ATOMIC_RELAXED);
+        // 文件末尾之外的整页（截断后 mmap 写的）不必落盘
+        if ((uint64)index * PGSIZE < ip->size) {
+            pcache_write_page(ip, (uint32)index);
+            n++;
+        }
+        start = (uint64)index + 1;
+    }
+    return n;
+}
+
+void
+pcache_write_page(struct inode *ip, uint32 index)
+{
+    char *page = pcache_lookup(ip, index);
+    if (page == 0) {
+        panic("pcache_write_page: page not cached");
+    }
+
+    uint32 addr = ibmap_write(ip, index);   // 共享块在这里写时复制
+    if (addr == 0) {
+        panic("pcache_write_page: bmap");
+    }
+    struct buf *b = bgetblk(ip->dev, addr);
+    copy_page((char *)b->data, page);
+    bwrite(b);
+    brelse(b);
+
+    ip->sync_seq     = log.seq;
+    ip->datasync_seq = log.seq;
+}
@@ -1,61 +1,608 @@
 #include "types.h"
 #include "memlayout.h"
 #include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "pmm.h"
+#include "fdt.h"
 
-// 空闲页链表的节点，直接放在页本身上
+// ------------ 伙伴系统（buddy allocator） ------------
+//
+// 物理内存按 2^order 页的块管理，order 从 0 到 MAX_ORDER-1。
+// 每个 order 一条空闲链表；分配时从最小够用的 order 取块并逐级对半拆分，
+// 释放时检查“伙伴”（pfn 第 order 位取反的那一块）是否也空闲且同阶，
+// 是则合并成更高一阶，直到无法合并为止。
+
+// 空闲块的链表节点，直接放在块的第一页上（双向链表，合并时 O(1) 摘除）
 struct run {
     struct run *next;
+    struct run *prev;
+};
+
+// 每个物理页的元数据，按 pfn 下标
+#define PG_FREE 0x1   // 该页是某个空闲块的首页
+#define PG_HEAD 0x2   // 该页是某个已分配块的首页
+#define PG_SLAB 0x4   // 该已分配块被 slab 分配器用作一个 slab
+
+struct page {
+    uint8 flags;
+    uint8 order;      // 作为块首页时，块的阶
+    uint8 tag;        // 作为已分配块首页时，分配者的 mem_tag
+    uint32 ref;       // 作为已分配块首页时的引用计数（COW 共享的用户页 > 1）
 };
 
+#define PA2PFN(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PFN2PA(pfn) (KERNBASE + (uint64)(pfn) * PGSIZE)
+
+// 页元数据数组的大小取决于实际内存大小，启动时紧跟在内核之后划出来
+static struct page *pages;
+
+// 物理内存上界：启动时从设备树读出，读不到时用 PHYSTOP
+uint64 phys_top = PHYSTOP;
+
+// 全局伙伴系统：所有 CPU 共享，由自旋锁保护
 static struct {
-    struct run *freelist;
+    struct spinlock lock;
+    struct run free_area[MAX_ORDER];   // 每阶空闲链表的伪头结点
+    uint64 nr_free[MAX_ORDER];         // 每阶空闲块数
+    uint64 nfree;                      // 空闲页总数
+    uint64 pfn_start;                  // 可分配范围 [pfn_start, pfn_end)
+    uint64 pfn_end;
+    uint64 peak;                       // 离开伙伴系统的页数峰值（含各 CPU 缓存中的页）
 } kmem;
 
+// 每个 CPU 私有的页缓存：常见的分配/释放只操作本 CPU 的链表，
+// 不碰共享 cache line；只有缓存空了/满了才成批地和伙伴系统交换。
+// 访问时 push_off() 关中断，防止同一 CPU 上的中断处理程序重入。
+#define PCP_HIGH  64    // 本地缓存超过这个数就往伙伴系统归还一批
+#define PCP_BATCH 16    // 每次 refill/drain 搬运的页数
+
+struct pcp_cache {
+    struct run *list;
+    int count;
+} __attribute__((aligned(64)));
+
+static struct pcp_cache pcp[NCPU];
+
+// 按分配者（mem_tag）统计的计数器，每个 CPU 一份，只在本 CPU 关中断时修改，
+// 读的时候把各 CPU 加起来。某个 CPU 上的 used 可能是负数（在别的 CPU 上分配、这里释放）。
+struct pmm_cpustat {
+    int64  used[NMEMTAG];     // 当前占用的页数
+    uint64 nalloc[NMEMTAG];   // 累计分配次数
+} __attribute__((aligned(64)));
+
+static struct pmm_cpustat pmm_stat[NCPU];
+
+static const char *mem_tag_names[NMEMTAG] = {
+    [MT_OTHER]     = "other",
+    [MT_PGTABLE]   = "pgtable",
+    [MT_KSTACK]    = "kstack",
+    [MT_SLAB]      = "slab",
+    [MT_KMALLOC]   = "kmalloc",
+    [MT_USER]      = "user",
+    [MT_PAGECACHE] = "pagecache",
+};
+
+// 记一笔分配/释放（调用者已关中断：持有自旋锁或在 push_off 内）
+static inline void
+account(int tag, int64 npages, int is_alloc)
+{
+    struct pmm_cpustat *st = &pmm_stat[cpuid()];
+    st->used[tag] += npages;
+    if (is_alloc) {
+        st->nalloc[tag]++;
+    }
+}
+
 // 由链接脚本提供：内核结束地址（代码+数据+BSS+栈）之后就是可分配物理内存
 extern char kernel_end[];
 
+// ------------ 伙伴系统内部操作（调用者持有 kmem.lock） ------------
+
+static void
+list_add(struct run *head, struct run *r)
+{
+    r->next = head->next;
+    r->prev = head;
+    head->next->prev = r;
+    head->next = r;
+}
+
+static void
+list_del(struct run *r)
+{
+    r->prev->next = r->next;
+    r->next->prev = r->prev;
+}
+
+// 把以 pfn 为首、阶为 order 的块挂到空闲链表上
+static void
+add_free_block(uint64 pfn, int order)
+{
+    pages[pfn].flags = PG_FREE;
+    pages[pfn].order = order;
+    list_add(&kmem.free_area[order], (struct run *)PFN2PA(pfn));
+    kmem.nr_free[order]++;
+}
+
+static void
+del_free_block(uint64 pfn, int order)
+{
+    list_del((struct run *)PFN2PA(pfn));
+    pages[pfn].flags = 0;
+    kmem.nr_free[order]--;
+}
+
+// 从伙伴系统取一个 2^order 页的块，返回首页 pfn；没有则返回 -1
+static int64
+buddy_alloc(int order)
+{
+    int o = order;
+    while (o < MAX_ORDER && kmem.nr_free[o] == 0) {
+        o++;
+    }
+    if (o == MAX_ORDER) {
+        return -1;
+    }
+
+    struct run *r = kmem.free_area[o].next;
+    uint64 pfn = PA2PFN(r);
+    del_free_block(pfn, o);
+
+    // 逐级对半拆分，后一半放回低一阶的空闲链表
+    while (o > order) {
+        o--;
+        add_free_block(pfn + (1UL << o), o);
+    }
+
+    pages[pfn].flags = PG_HEAD;
+    pages[pfn].order = order;
+    kmem.nfree -= 1UL << order;
+
+    uint64 used = (kmem.pfn_end - kmem.pfn_start) - kmem.nfree;
+    if (used > kmem.peak) {
+        kmem.peak = used;
+    }
+    return (int64)pfn;
+}
+
+// 把一个 2^order 页的块还给伙伴系统，尽可能与伙伴合并
+static void
+buddy_free(uint64 pfn, int order)
+{
+    kmem.nfree += 1UL << order;
+    pages[pfn].flags = 0;
+
+    while (order < MAX_ORDER - 1) {
+        uint64 buddy = pfn ^ (1UL << order);
+        if (buddy < kmem.pfn_start || buddy + (1UL << order) > kmem.pfn_end) {
+            break;
+        }
+        if (pages[buddy].flags != PG_FREE || pages[buddy].order != order) {
+            break;
+        }
+        del_free_block(buddy, order);
+        if (buddy < pfn) {
+            pfn = buddy;
+        }
+        order++;
+    }
+
+    add_free_block(pfn, order);
+}
+
+static void
+check_block(void *pa, int order, const char *who)
+{
+    uint64 addr = (uint64)pa;
+
+    // 简单的合法性检查：对齐到块大小，且整块落在可分配范围内
+    if (order < 0 || order >= MAX_ORDER ||
+        addr % (PGSIZE << order) != 0 ||
+        addr < PFN2PA(kmem.pfn_start) ||
+        addr + (PGSIZE << order) > PFN2PA(kmem.pfn_end)) {
+        panic(who);
+    }
+}
+
+// ------------ 引用计数 ------------
+//
+// 分配时置 1；COW fork 让多个页表共享同一物理页时加 1。
+// free_page/free_pages 先减引用，减到 0 才真正还给分配器。
+
+// 减一个引用，返回剩余的引用数
+static uint32
+page_put(uint64 pfn)
+{
+    if (pages[pfn].ref == 0) {
+        panic("page_put: page not in use");
+    }
+    return __atomic_sub_fetch(&pages[pfn].ref, 1, __ATOMIC_ACQ_REL);
+}
+
+void
+page_ref_inc(void *pa)
+{
+    uint64 pfn = PA2PFN(pa);
+    if (pages[pfn].ref == 0) {
+        panic("page_ref_inc: page not in use");
+    }
+    __atomic_add_fetch(&pages[pfn].ref, 1, __ATOMIC_RELAXED);
+}
+
+uint32
+page_refcnt(void *pa)
+{
+    return __atomic_load_n(&pages[PA2PFN(pa)].ref, __ATOMIC_ACQUIRE);
+}
+
+// ------------ 多页分配接口 ------------
+
+void *
+alloc_pages_tag(int order, int tag)
+{
+    if (order < 0 || order >= MAX_ORDER || tag < 0 || tag >= NMEMTAG) {
+        return 0;
+    }
+
+    acquire(&kmem.lock);
+    int64 pfn = buddy_alloc(order);
+    if (pfn >= 0) {
+        pages[pfn].tag = tag;
+        pages[pfn].ref = 1;
+        account(tag, 1L << order, 1);
+    }
+    release(&kmem.lock);
+
+    return pfn < 0 ? 0 : (void *)PFN2PA(pfn);
+}
+
+void *
+alloc_pages(int order)
+{
+    return alloc_pages_tag(order, MT_OTHER);
+}
+
+void
+free_pages(void *pa, int order)
+{
+    check_block(pa, order, "free_pages: bad address");
+
+    uint64 pfn = PA2PFN(pa);
+
+    if (page_put(pfn) > 0) {
+        return;   // 还有别人在用
+    }
+
+    acquire(&kmem.lock);
+    if ((pages[pfn].flags & ~PG_SLAB) != PG_HEAD || pages[pfn].order != order) {
+        release(&kmem.lock);
+        panic("free_pages: not an allocated block of this order");
+    }
+    account(pages[pfn].tag, -(1L << order), 0);
+    buddy_free(pfn, order);
+    release(&kmem.lock);
+}
+
+// 找到包含 pa 的已分配块：返回块首地址，并通过 order 返回块的阶；
+// pa 不在任何已分配块内时返回 0。调用者必须拥有该块（块不会并发释放）。
+void *
+pmm_block_head(void *pa, int *order)
+{
+    uint64 pfn = PA2PFN(PGROUNDDOWN(pa));
+
+    if ((uint64)pa < PFN2PA(kmem.pfn_start) || (uint64)pa >= PFN2PA(kmem.pfn_end)) {
+        return 0;
+    }
+
+    // 块按自身大小对齐：从小到大尝试每一阶的对齐位置，第一个块首页就是它
+    for (int o = 0; o < MAX_ORDER; o++) {
+        uint64 head = pfn & ~((1UL << o) - 1);
+        if ((pages[head].flags & PG_HEAD) && pfn < head + (1UL << pages[head].order)) {
+            if (order) {
+                *order = pages[head].order;
+            }
+            return (void *)PFN2PA(head);
+        }
+    }
+    return 0;
+}
+
+// 标记/查询一个已分配块是否是 slab（pa 必须是块首地址）
+void
+pmm_set_slab(void *pa, int on)
+{
+    uint64 pfn = PA2PFN(pa);
+    if (on) {
+        pages[pfn].flags |= PG_SLAB;
+    } else {
+        pages[pfn].flags &= ~PG_SLAB;
+    }
+}
+
+int
+pmm_is_slab(void *pa)
+{
+    return (pages[PA2PFN(pa)].flags & PG_SLAB) != 0;
+}
+
+// ------------ 单页快路径：per-CPU 页缓存 ------------
+
+// 从伙伴系统取最多 PCP_BATCH 个单页到本地缓存，返回实际搬运的页数
+static int
+pcp_refill(struct pcp_cache *pc)
+{
+    int n = 0;
+
+    acquire(&kmem.lock);
+    while (n < PCP_BATCH) {
+        int64 pfn = buddy_alloc(0);
+        if (pfn < 0) {
+            break;
+        }
+        struct run *r = (struct run *)PFN2PA(pfn);
+        r->next = pc->list;
+        pc->list = r;
+        n++;
+    }
+    release(&kmem.lock);
+
+    pc->count += n;
+    return n;
+}
+
+// 把本地缓存中的 n 页还给伙伴系统
+static void
+pcp_drain(struct pcp_cache *pc, int n)
+{
+    if (n > pc->count) {
+        n = pc->count;
+    }
+
+    acquire(&kmem.lock);
+    for (int i = 0; i < n; i++) {
+        struct run *r = pc->list;
+        pc->list = r->next;
+        buddy_free(PA2PFN(r), 0);
+    }
+    release(&kmem.lock);
+
+    pc->count -= n;
+}
+
 void
 free_page(void *pa)
 {
-    struct run *r;
-    uint64 addr = (uint64)pa;
+    check_block(pa, 0, "free_page: bad address");
 
-    // 简单的合法性检查
-    if (addr % PGSIZE != 0 || addr < KERNBASE || addr >= PHYSTOP) {
-        panic("free_page: bad address");
+    // 高阶块的首页混进来时只会把一页挂到每 CPU 链表上，其余的页就丢了
+    uint64 pfn = PA2PFN(pa);
+    if ((pages[pfn].flags & ~PG_SLAB) != PG_HEAD || pages[pfn].order != 0) {
+        panic("free_page: not an allocated order-0 page");
     }
 
-    r = (struct run*)pa;
-    r->next = kmem.freelist;
-    kmem.freelist = r;
+    struct run *r = (struct run*)pa;
+
+    if (page_put(PA2PFN(pa)) > 0) {
+        return;   // COW 共享页：只是少了一个引用
+    }
+
+    push_off();
+    account(pages[PA2PFN(pa)].tag, -1, 0);
+    struct pcp_cache *pc = &pcp[cpuid()];
+    r->next = pc->list;
+    pc->list = r;
+    pc->count++;
+    if (pc->count > PCP_HIGH) {
+        pcp_drain(pc, PCP_BATCH);
+    }
+    pop_off();
 }
 
 void *
-alloc_page(void)
+alloc_page_tag(int tag)
 {
-    struct run *r = kmem.freelist;
-    if (r) {
-        kmem.freelist = r->next;
+    struct run *r = 0;
+
+    if (tag < 0 || tag >= NMEMTAG) {
+        return 0;
+    }
+
+    push_off();
+    struct pcp_cache *pc = &pcp[cpuid()];
+    if (pc->count > 0 || pcp_refill(pc) > 0) {
+        r = pc->list;
+        pc->list = r->next;
+        pc->count--;
+        pages[PA2PFN(r)].tag = tag;
+        pages[PA2PFN(r)].ref = 1;
+        account(tag, 1, 1);
     }
+    pop_off();
+
     return (void*)r;   // 返回物理地址（目前是恒等映射，可直接当作虚拟地址用）
 }
 
+void *
+alloc_page(void)
+{
+    return alloc_page_tag(MT_OTHER);
+}
+
+// 当前空闲页总数：伙伴系统 + 各 CPU 缓存（各 CPU 的计数不加锁读取，只是近似值）
+uint64
+pmm_free_pages(void)
+{
+    uint64 n = kmem.nfree;
+    for (int i = 0; i < NCPU; i++) {
+        n += pcp[i].count;
+    }
+    return n;
+}
+
+// 某一阶当前的空闲块数
+uint64
+pmm_free_blocks(int order)
+{
+    if (order < 0 || order >= MAX_ORDER) {
+        return 0;
+    }
+    return kmem.nr_free[order];
+}
+
+// 汇总统计：各 CPU 计数器不加锁读取，结果是近似快照
+void
+pmm_get_stats(struct mem_stats *ms)
+{
+    ms->total_pages = kmem.pfn_end - kmem.pfn_start;
+    ms->free_pages  = pmm_free_pages();
+    ms->used_pages  = ms->total_pages - ms->free_pages;
+    ms->peak_pages  = kmem.peak;
+
+    for (int o = 0; o < MAX_ORDER; o++) {
+        ms->free_blocks[o] = kmem.nr_free[o];
+    }
+    for (int t = 0; t < NMEMTAG; t++) {
+        ms->tag_pages[t]  = 0;
+        ms->tag_allocs[t] = 0;
+        for (int i = 0; i < NCPU; i++) {
+            ms->tag_pages[t]  += pmm_stat[i].used[t];
+            ms->tag_allocs[t] += pmm_stat[i].nalloc[t];
+        }
+    }
+}
+
+// 打印内存使用情况：总量/已用/峰值、按分配者的占用、伙伴系统的碎片情况。
+// 碎片用“不可用空闲比例”衡量：对每一阶 o，空闲页里落在小于 o 阶的块中、
+// 因而无法满足一次 2^o 页分配的比例（0% 表示完全没有碎片）。
+void
+debug_memory_state(void)
+{
+    struct mem_stats ms;
+    pmm_get_stats(&ms);
+
+    printf("=== Physical Memory ===\n");
+    printf("Range: %p - %p\n", PFN2PA(kmem.pfn_start), PFN2PA(kmem.pfn_end));
+    printf("Pages: total=%d free=%d used=%d peak=%d\n",
+           (int)ms.total_pages, (int)ms.free_pages, (int)ms.used_pages, (int)ms.peak_pages);
+
+    printf("By tag (pages / allocations):\n");
+    for (int t = 0; t < NMEMTAG; t++) {
+        printf("  %s: %d / %d\n", mem_tag_names[t], (int)ms.tag_pages[t], (int)ms.tag_allocs[t]);
+    }
+
+    printf("Buddy free blocks and fragmentation:\n");
+    uint64 buddy_free_pages = 0;
+    for (int o = 0; o < MAX_ORDER; o++) {
+        buddy_free_pages += ms.free_blocks[o] << o;
+    }
+    uint64 below = 0;   // 阶数小于 o 的空闲块里的页数
+    int largest = -1;
+    for (int o = 0; o < MAX_ORDER; o++) {
+        int unusable = buddy_free_pages ? (int)(below * 100 / buddy_free_pages) : 0;
+        printf("  order %d: blocks=%d unusable=%d%%\n", o, (int)ms.free_blocks[o], unusable);
+        below += ms.free_blocks[o] << o;
+        if (ms.free_blocks[o] > 0) {
+            largest = o;
+        }
+    }
+    printf("Largest free block: order %d\n", largest);
+}
+
+// 确定物理内存上界：以设备树里的 memory 节点为准，没有可用的节点时才退回 PHYSTOP
+static uint64
+detect_phys_top(void)
+{
+    uint64 base, size;
+
+    if (fdt_memory(boot_dtb, &base, &size) < 0) {
+        printf("pmm_init: no usable device tree, assuming %p\n", (uint64)PHYSTOP);
+        return PHYSTOP;
+    }
+    if (base != KERNBASE) {
+        printf("pmm_init: memory node at unexpected base=%p, assuming %p\n",
+               base, (uint64)PHYSTOP);
+        return PHYSTOP;
+    }
+
+    // 内存再小也以设备树为准：按 PHYSTOP 建空闲链表会把不存在的内存发出去
+    uint64 top = PGROUNDDOWN(base + size);
+    if (top <= PGROUNDUP((uint64)kernel_end)) {
+        panic("pmm_init: RAM smaller than the kernel image");
+    }
+    if (top > PHYSTOP_MAX) {
+        top = PHYSTOP_MAX;
+    }
+    return top;
+}
+
+// 把 [pfn, end) 切成尽可能大的、按自身大小对齐的块直接挂进空闲链表。
+// 只写每个块首页的链表节点和元数据，块数约为 (页数 / 2^(MAX_ORDER-1)) + 2*MAX_ORDER，
+// 不再逐页调用 buddy_free。
+static void
+free_range(uint64 pfn, uint64 end)
+{
+    while (pfn < end) {
+        int order = MAX_ORDER - 1;
+        while (order > 0 &&
+               ((pfn & ((1UL << order) - 1)) != 0 || pfn + (1UL << order) > end)) {
+            order--;
+        }
+        add_free_block(pfn, order);
+        kmem.nfree += 1UL << order;
+        pfn += 1UL << order;
+    }
+}
+
 // 初始化物理内存管理器：
-// 从 kernel_end 开始，一直到 PHYSTOP，把每个物理页挂到空闲链表中。
+// 1. 从设备树得到内存上界 phys_top；
+// 2. 在 kernel_end 之后划出页元数据数组并成块清零（每页一个 struct page，8 字节）；
+// 3. 剩下的 [pa_start, phys_top) 按最大对齐块直接建立伙伴系统空闲链表。
+// 不逐页触碰空闲内存，启动开销基本与内存大小无关。
 void
 pmm_init(void)
 {
-    uint64 pa_start = PGROUNDUP((uint64)kernel_end);
-    uint64 pa_end   = PHYSTOP;
+    phys_top = detect_phys_top();
+
+    uint64 npages = (phys_top - KERNBASE) / PGSIZE;
+    uint64 meta   = PGROUNDUP((uint64)kernel_end);
+    uint64 metasz = PGROUNDUP(npages * sizeof(struct page));
+
+    uint64 pa_start = meta + metasz;
+    uint64 pa_end   = phys_top;
 
-    printf("pmm_init: kernel_end=%p, PHYSTOP=%p\n",
-           (uint64)kernel_end, (uint64)PHYSTOP);
+    printf("pmm_init: kernel_end=%p, phys_top=%p (%d MB)\n",
+           (uint64)kernel_end, pa_end, (int)((pa_end - KERNBASE) >> 20));
 
-    for (uint64 p = pa_start; p + PGSIZE <= pa_end; p += PGSIZE) {
-        free_page((void*)p);
+    // 元数据清零：按 8 字节写，metasz 是页的整数倍
+    pages = (struct page *)meta;
+    for (uint64 *w = (uint64 *)meta; w < (uint64 *)pa_start; w++) {
+        *w = 0;
     }
 
-    printf("pmm_init: free pages from %p to %p\n",
-           (uint64)pa_start, (uint64)pa_end);
+    initlock(&kmem.lock, "kmem");
+    for (int o = 0; o < MAX_ORDER; o++) {
+        kmem.free_area[o].next = &kmem.free_area[o];
+        kmem.free_area[o].prev = &kmem.free_area[o];
+        kmem.nr_free[o] = 0;
+    }
+    kmem.nfree     = 0;
+    kmem.peak      = 0;
+    kmem.pfn_start = PA2PFN(pa_start);
+    kmem.pfn_end   = PA2PFN(pa_end);
+
+    for (int i = 0; i < NCPU; i++) {
+        pcp[i].list  = 0;
+        pcp[i].count = 0;
+        for (int t = 0; t < NMEMTAG; t++) {
+            pmm_stat[i].used[t]   = 0;
+            pmm_stat[i].nalloc[t] = 0;
+        }
+    }
+
+    // 启动阶段直接交给伙伴系统，不经过本地缓存
+    free_range(kmem.pfn_start, kmem.pfn_end);
+
+    printf("pmm_init: free pages from %p to %p (%d pages, %d page metadata)\n",
+           (uint64)pa_start, (uint64)pa_end, (int)kmem.nfree, (int)(metasz / PGSIZE));
 }
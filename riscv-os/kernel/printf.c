@@ -48,7 +48,7 @@ printptr(uint64 x)
     }
 }
 
-// 内核 printf：支持 %d %u %x %p %s %c %%
+// 内核 printf：支持 %d %u %x %p %s %c %%，以及 64 位的 %ld %lu %lx
 int
 printf(const char *fmt, ...)
 {
@@ -80,6 +80,24 @@ printf(const char *fmt, ...)
         case 'x':   // 无符号十六进制
             printint(va_arg(ap, unsigned int), 16, 0);
             break;
+        case 'l':   // 64 位整数：%ld %lu %lx
+            c = *++p & 0xff;
+            if (c == 'd') {
+                printint(va_arg(ap, long), 10, 1);
+            } else if (c == 'u') {
+                printint(va_arg(ap, unsigned long), 10, 0);
+            } else if (c == 'x') {
+                printint(va_arg(ap, unsigned long), 16, 0);
+            } else {
+                console_putc('%');
+                console_putc('l');
+                if (c == 0) {
+                    p--;   // 让外层循环看到字符串结尾
+                } else {
+                    console_putc(c);
+                }
+            }
+            break;
         case 'p':   // 指针
             printptr(va_arg(ap, uint64));
             break;
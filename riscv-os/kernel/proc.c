@@ -1,19 +1,32 @@
 #include "types.h"
 #include "memlayout.h"
 #include "printf.h"
+#include "riscv.h"
+#include "spinlock.h"
 #include "pmm.h"
+#include "vm.h"
+#include "trap.h"
 #include "proc.h"
 
 struct proc procs[NPROC];
-struct proc *current_proc = 0;
 
-// 调度器自己用的上下文（在“main 那个栈”上）
-static struct context sched_context;
+// 每个 CPU 一份调度器状态：调度上下文 + 就绪队列 + 统计
+struct cpu cpus[NCPU];
+
 static int next_pid = 1;
 
 // swtch.S
 extern void swtch(struct context *old, struct context *new);
 
+// trampoline.S
+extern char trampoline[];
+
+// ASID 分配：按“代”单调递增，同一代里每个 ASID 只发一次，
+// 用完了就进入下一代，各 CPU 在下次进入用户态前整体刷一次 TLB。
+static struct spinlock asid_lock;
+static uint64 asid_generation;
+static uint64 asid_next;
+
 // 简单字符串拷贝
 static void
 kstrncpy(char *dst, const char *src, int n)
@@ -25,6 +38,127 @@ kstrncpy(char *dst, const char *src, int n)
   dst[i] = 0;
 }
 
+// 当前 hart 号：start() 里已经把 mhartid 放进了 tp
+int
+cpuid(void)
+{
+  return (int)r_tp();
+}
+
+struct cpu *
+mycpu(void)
+{
+  int id = cpuid();
+  if (id < 0 || id >= NCPU) {
+    panic("mycpu: bad hartid");
+  }
+  return &cpus[id];
+}
+
+// 本 CPU 上正在运行的线程。关中断读，免得读到一半被换到别的 CPU 上
+struct proc *
+myproc(void)
+{
+  push_off();
+  struct proc *p = mycpu()->proc;
+  pop_off();
+  return p;
+}
+
+// ------------ 就绪队列操作（调用者持有 rq->lock） ------------
+
+static void
+rq_push(struct runqueue *rq, struct proc *p)
+{
+  if (rq->count >= NPROC) {
+    panic("rq_push: runqueue full");
+  }
+  rq->q[(rq->head + rq->count) % NPROC] = p;
+  rq->count++;
+}
+
+static struct proc *
+rq_pop(struct runqueue *rq)
+{
+  if (rq->count == 0) {
+    return 0;
+  }
+  struct proc *p = rq->q[rq->head];
+  rq->head = (rq->head + 1) % NPROC;
+  rq->count--;
+  return p;
+}
+
+// 把线程放进 c 的就绪队列尾部
+static void
+enqueue(struct cpu *c, struct proc *p)
+{
+  acquire(&c->rq.lock);
+  rq_push(&c->rq, p);
+  release(&c->rq.lock);
+}
+
+// 新线程放到当前最空闲的 CPU 上（只读 count 做估计，不加锁）
+static struct cpu *
+select_cpu(void)
+{
+  struct cpu *best = mycpu();
+  for (int i = 0; i < NCPU; i++) {
+    if (cpus[i].rq.count < best->rq.count) {
+      best = &cpus[i];
+    }
+  }
+  return best;
+}
+
+// 本 CPU 空闲时，从排队最多的邻居那里偷一半线程过来。
+// 返回其中一个直接运行，其余放进本 CPU 的就绪队列。
+static struct proc *
+steal_work(struct cpu *c)
+{
+  struct cpu *victim = 0;
+  int most = 0;
+
+  for (int i = 0; i < NCPU; i++) {
+    struct cpu *v = &cpus[i];
+    if (v != c && v->rq.count > most) {
+      most = v->rq.count;
+      victim = v;
+    }
+  }
+  if (victim == 0) {
+    return 0;
+  }
+
+  // 只持有 victim 的锁把线程摘下来，避免同时持有两把 rq 锁
+  struct proc *batch[NPROC];
+  int n = 0;
+
+  acquire(&victim->rq.lock);
+  int want = (victim->rq.count + 1) / 2;
+  while (n < want) {
+    batch[n++] = rq_pop(&victim->rq);
+  }
+  release(&victim->rq.lock);
+
+  if (n == 0) {
+    return 0;   // 估计的时候还有，真正加锁后已经被别人拿走了
+  }
+
+  // nstolen 属于别的 CPU，它自己的调度器也可能同时在读写这个 struct cpu
+  __atomic_fetch_add(&victim->nstolen, n, __ATOMIC_RELAXED);
+  c->nsteal += n;
+
+  if (n > 1) {
+    acquire(&c->rq.lock);
+    for (int i = 1; i < n; i++) {
+      rq_push(&c->rq, batch[i]);
+    }
+    release(&c->rq.lock);
+  }
+  return batch[0];
+}
+
 // 初始化进程表
 void
 proc_init(void)
@@ -34,10 +168,27 @@ proc_init(void)
     procs[i].state  = PROC_UNUSED;
     procs[i].kstack = 0;
     procs[i].name[0] = 0;
+    procs[i].cpu    = -1;
+    procs[i].pagetable = 0;
+    procs[i].trapframe = 0;
+  }
+  initlock(&asid_lock, "asid");
+  asid_generation = 1;
+  asid_next = 1;
+  for (int i = 0; i < NCPU; i++) {
+    cpus[i].proc     = 0;
+    cpus[i].asid_gen = 0;
+    cpus[i].upt      = 0;
+    initlock(&cpus[i].rq.lock, "runqueue");
+    cpus[i].rq.head  = 0;
+    cpus[i].rq.count = 0;
+    cpus[i].nswitch  = 0;
+    cpus[i].nsteal   = 0;
+    cpus[i].nstolen  = 0;
+    cpus[i].nmigrate = 0;
   }
-  current_proc = 0;
   next_pid = 1;
-  printf("proc_init: NPROC=%d\n", NPROC);
+  printf("proc_init: NPROC=%d NCPU=%d\n", NPROC, NCPU);
 }
 
 // 内部：分配一个 UNUSED 的 proc，设置好栈和入口函数
@@ -59,17 +210,31 @@ alloc_proc(void (*fn)(void), const char *name)
 
   p->pid   = next_pid++;
   p->state = PROC_RUNNABLE;
+  p->cpu   = -1;
+  p->pagetable = 0;
+  p->trapframe = 0;
+  p->sz        = 0;
+  p->heapbase  = 0;
+  p->guard     = 0;
+  p->mmapbase  = 0;
+  for (int i = 0; i < NVMA; i++) {
+    p->vmas[i].end = 0;
+  }
+  p->asid      = 0;
+  p->asid_gen  = 0;
+  p->killed    = 0;
+  p->xstate    = 0;
 
-  // 分配一页作为内核栈（pmm_init 已在实验三里做过）
-  void *stack = alloc_page();
+  // 分配连续多页作为内核栈（pmm_init 已在实验三里做过）
+  void *stack = alloc_pages_tag(KSTACK_ORDER, MT_KSTACK);
   if (stack == 0) {
-    panic("alloc_proc: alloc_page for kstack failed");
+    panic("alloc_proc: alloc_pages for kstack failed");
   }
   p->kstack = (uint64)stack;
 
-  // 设置初始上下文：返回地址 = 线程函数；栈顶 = kstack + PGSIZE
+  // 设置初始上下文：返回地址 = 线程函数；栈顶 = kstack + KSTACK_SIZE
   p->context.ra = (uint64)fn;
-  p->context.sp = p->kstack + PGSIZE;
+  p->context.sp = p->kstack + KSTACK_SIZE;
 
   kstrncpy(p->name, name ? name : "kthread", sizeof(p->name));
 
@@ -86,82 +251,416 @@ kproc_create(void (*fn)(void), const char *name)
     return 0;
   }
 
-  printf("kproc_create: pid=%d name=%s kstack=%p\n",
-         p->pid, p->name, (uint64)p->kstack);
+  struct cpu *c = select_cpu();
+  enqueue(c, p);
+
+  printf("kproc_create: pid=%d name=%s kstack=%p cpu=%d\n",
+         p->pid, p->name, (uint64)p->kstack, (int)(c - cpus));
+  return p;
+}
+
+// ------------ 用户进程 ------------
+
+// 新建用户页表：只有 trampoline 和 trapframe 两页，都不带 PTE_U
+static pagetable_t
+proc_pagetable(struct proc *p)
+{
+  pagetable_t pt = create_pagetable();
+  if (pt == 0) {
+    return 0;
+  }
+  if (map_page(pt, TRAMPOLINE, (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0 ||
+      map_page(pt, TRAPFRAME, (uint64)p->trapframe, PTE_R | PTE_W) < 0) {
+    uvmunmap(pt, TRAMPOLINE, 1, 0);
+    uvmunmap(pt, TRAPFRAME, 1, 0);
+    uvmfree(pt, 0);
+    return 0;
+  }
+  return pt;
+}
+
+// 释放用户进程的页表、用户内存和 trapframe
+static void
+proc_freeuser(struct proc *p)
+{
+  if (p->pagetable) {
+    vma_exit(p);
+    uvmunmap(p->pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(p->pagetable, TRAPFRAME, 1, 0);
+    uvmfree(p->pagetable, p->sz);
+
+    // 页表页会被重用：不支持 ASID 时别让 CPU 误以为还是同一个地址空间
+    for (int i = 0; i < NCPU; i++) {
+      if (cpus[i].upt == p->pagetable) {
+        cpus[i].upt = 0;
+      }
+    }
+    p->pagetable = 0;
+  }
+  if (p->trapframe) {
+    free_page(p->trapframe);
+    p->trapframe = 0;
+  }
+  p->sz = 0;
+}
+
+// 用户进程第一次被调度时从这里开始（在它自己的内核栈上），直接返回用户态
+static void
+uproc_start(void)
+{
+  usertrapret();
+}
+
+// 创建用户进程，地址空间布局：
+//   [0, codesz)                      代码（R|X|U，codesz 按页向上取整）
+//   [codesz, codesz+PGSIZE)          guard page（不映射，栈溢出会被杀掉）
+//   [codesz+PGSIZE, heapbase)        用户栈 USTACK_SIZE，碰到才分配
+//   [heapbase, sz)                   堆，sbrk 只调 sz，碰到才分配
+//   [mmapbase, USERTOP)              mmap 的文件映射，从 USERTOP 往下长
+struct proc *
+uproc_create(const void *code, uint64 len, const char *name)
+{
+  if (len == 0 || len > 16 * PGSIZE) {
+    return 0;
+  }
+
+  struct proc *p = alloc_proc(uproc_start, name);
+  if (p == 0) {
+    printf("uproc_create: no free proc slot\n");
+    return 0;
+  }
+
+  if ((p->trapframe = (struct trapframe *)alloc_page_tag(MT_USER)) == 0 ||
+      (p->pagetable = proc_pagetable(p)) == 0) {
+    goto bad;
+  }
+
+  uint64 codesz = PGROUNDUP(len);
+  for (uint64 a = 0; a < codesz; a += PGSIZE) {
+    char *mem = (char *)alloc_page_tag(MT_USER);
+    if (mem == 0) {
+      goto bad;
+    }
+    for (uint64 i = 0; i < PGSIZE; i++) {
+      mem[i] = (a + i < len) ? ((const char *)code)[a + i] : 0;
+    }
+    if (map_page(p->pagetable, a, (uint64)mem, PTE_R | PTE_X | PTE_U) < 0) {
+      free_page(mem);
+      goto bad;
+    }
+    p->sz = a + PGSIZE;
+  }
+
+  p->guard    = codesz;
+  p->heapbase = codesz + PGSIZE + USTACK_SIZE;
+  p->sz       = p->heapbase;
+  p->mmapbase = USERTOP;
+
+  char *tf = (char *)p->trapframe;
+  for (uint64 i = 0; i < sizeof(struct trapframe); i++) {
+    tf[i] = 0;
+  }
+  p->trapframe->epc = 0;
+  p->trapframe->sp  = p->sz;
+
+  struct cpu *c = select_cpu();
+  enqueue(c, p);
+
+  printf("uproc_create: pid=%d name=%s sz=%p cpu=%d\n",
+         p->pid, p->name, p->sz, (int)(c - cpus));
   return p;
+
+bad:
+  proc_freeuser(p);
+  free_pages((void *)p->kstack, KSTACK_ORDER);
+  p->kstack = 0;
+  p->state = PROC_UNUSED;
+  printf("uproc_create: out of memory\n");
+  return 0;
 }
 
-// 简单调度器：轮询所有 RUNNABLE 线程，直到都变成 ZOMBIE
+// 用户进程退出：释放用户地址空间，然后和内核线程一样退出
 void
-scheduler_run(void)
+uproc_exit(int status)
 {
-  printf("[scheduler] start\n");
+  struct proc *p = myproc();
+  if (p == 0 || p->pagetable == 0) {
+    panic("uproc_exit: not a user process");
+  }
 
-  for (;;) {
-    int runnable = 0;
+  p->xstate = status;
+  proc_freeuser(p);
+  kproc_exit();
+}
 
-    for (int i = 0; i < NPROC; i++) {
-      struct proc *p = &procs[i];
+// 用户缺页：落在文件映射里的交给 vma_fault；
+// va 在 [0, sz) 内且不是 guard page 时按需分配/写时复制。
+// 成功返回 0，否则返回 -1（调用者杀掉进程或让系统调用失败）。
+int
+proc_fault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v = vma_lookup(p, va);
+  if (v) {
+    return vma_fault(p, v, va, write);
+  }
+  if (va >= p->sz || PGROUNDDOWN(va) == p->guard) {
+    return -1;
+  }
+  return uvm_fault_in(p->pagetable, va, write);
+}
 
-      if (p->state == PROC_RUNNABLE) {
-        runnable = 1;
-        current_proc = p;
-        p->state = PROC_RUNNING;
+// sbrk：增长时只挪 break，物理页在第一次访问时才分配；
+// 缩小时释放 break 以上已经分配的页并刷 TLB
+int
+proc_grow(int64 n)
+{
+  struct proc *p = myproc();
+  uint64 sz = p->sz;
 
-        printf("[scheduler] switch to pid=%d (%s)\n", p->pid, p->name);
+  if (n > 0) {
+    if (sz + n > p->mmapbase || sz + n < sz) {
+      return -1;
+    }
+    p->sz = sz + n;
+  } else if (n < 0) {
+    if ((uint64)(-n) > sz - p->heapbase) {
+      return -1;
+    }
+    uint64 newsz = sz + n;
+    uint64 from  = PGROUNDUP(newsz);
+    if (from < PGROUNDUP(sz)) {
+      uvmunmap(p->pagetable, from, (PGROUNDUP(sz) - from) / PGSIZE, 1);
+      proc_tlb_flush(p, (uint64)-1);
+    }
+    p->sz = newsz;
+  }
+  return 0;
+}
 
-        // 切到线程上下文；等线程 yield 或 exit 再切回 sched_context
-        swtch(&sched_context, &p->context);
+// 进入用户态前要写入 satp 的值：用户页表 + 本进程的 ASID。
+// 需要时在本 CPU 上刷 TLB（调用者已关中断）：
+//   - 支持 ASID：只有 ASID 进入新的一代时整体刷一次，平时切换地址空间不刷；
+//   - 不支持 ASID：换了一个地址空间就整体刷。
+uint64
+proc_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 asid = 0;
 
-        // 回到这里说明线程主动让出了 CPU（yield 或 exit）
-        current_proc = 0;
+  if (asid_max == 0) {
+    if (c->upt != p->pagetable) {
+      sfence_vma();
+    }
+  } else {
+    acquire(&asid_lock);
+    if (p->asid_gen != asid_generation) {
+      if (asid_next > asid_max) {
+        asid_generation++;
+        asid_next = 1;
       }
+      p->asid     = asid_next++;
+      p->asid_gen = asid_generation;
     }
+    asid = p->asid;
+    if (c->asid_gen != asid_generation) {
+      c->asid_gen = asid_generation;
+      sfence_vma();
+    }
+    release(&asid_lock);
+  }
+
+  c->upt = p->pagetable;
+  return MAKE_SATP(p->pagetable) | (asid << SATP_ASID_SHIFT);
+}
+
+// 刷掉 p 的地址空间在本 CPU 上的 TLB 项（收回权限、拆映射之后调用）
+void
+proc_tlb_flush(struct proc *p, uint64 va)
+{
+  if (asid_max == 0) {
+    sfence_vma();
+  } else if (p->asid_gen == asid_generation) {
+    if (va == (uint64)-1) {
+      sfence_vma_asid(p->asid);
+    } else {
+      sfence_vma_page(va, p->asid);
+    }
+  }
+  // ASID 属于旧的一代：进入用户态前会换新 ASID 并整体刷，这里不用管
+}
+
+// fork：子进程共享父进程的全部用户页（写时复制），
+// 从同一个用户 pc 继续，fork 在子进程里返回 0
+int
+uproc_fork(void)
+{
+  struct proc *p = myproc();
+  if (p == 0 || p->pagetable == 0) {
+    return -1;
+  }
+
+  struct proc *np = alloc_proc(uproc_start, p->name);
+  if (np == 0) {
+    return -1;
+  }
+
+  if ((np->trapframe = (struct trapframe *)alloc_page_tag(MT_USER)) == 0 ||
+      (np->pagetable = proc_pagetable(np)) == 0 ||
+      uvmcopy_cow(p->pagetable, np->pagetable, p->sz) < 0) {
+    goto bad;
+  }
+  np->sz       = p->sz;
+  np->heapbase = p->heapbase;
+  np->guard    = p->guard;
+  np->mmapbase = p->mmapbase;
+  if (vma_fork(p, np) < 0) {
+    proc_tlb_flush(p, (uint64)-1);   // uvmcopy_cow 已经收回了父进程的 W 位
+    goto bad;
+  }
+
+  // 父进程的可写页刚被改成只读，旧的可写 TLB 项必须作废
+  proc_tlb_flush(p, (uint64)-1);
+
+  *np->trapframe = *p->trapframe;
+  np->trapframe->a0 = 0;
+
+  enqueue(select_cpu(), np);
+  return np->pid;
+
+bad:
+  proc_freeuser(np);
+  free_pages((void *)np->kstack, KSTACK_ORDER);
+  np->kstack = 0;
+  np->state = PROC_UNUSED;
+  return -1;
+}
 
-    if (!runnable) {
+int
+either_copyout(int user_dst, uint64 dst, const void *src, uint64 len)
+{
+  struct proc *p = myproc();
+  if (user_dst && p && p->pagetable) {
+    return copyout(p->pagetable, dst, src, len);
+  }
+
+  char *d = (char *)dst;
+  const char *s = (const char *)src;
+  for (uint64 i = 0; i < len; i++) {
+    d[i] = s[i];
+  }
+  return 0;
+}
+
+int
+either_copyin(void *dst, int user_src, uint64 src, uint64 len)
+{
+  struct proc *p = myproc();
+  if (user_src && p && p->pagetable) {
+    return copyin(p->pagetable, dst, src, len);
+  }
+
+  char *d = (char *)dst;
+  const char *s = (const char *)src;
+  for (uint64 i = 0; i < len; i++) {
+    d[i] = s[i];
+  }
+  return 0;
+}
+
+// 调度器：先从本 CPU 的就绪队列取线程，队列空了就去邻居那里偷；
+// 所有 CPU 的队列都空了说明没有可运行线程，退回测试代码。
+void
+scheduler_run(void)
+{
+  struct cpu *c = mycpu();
+
+  printf("[scheduler] start on cpu %d\n", cpuid());
+
+  for (;;) {
+    acquire(&c->rq.lock);
+    struct proc *p = rq_pop(&c->rq);
+    release(&c->rq.lock);
+
+    if (p == 0) {
+      p = steal_work(c);
+    }
+    if (p == 0) {
       break;  // 没有可运行线程了，退回测试代码
     }
+
+    if (p->cpu >= 0 && p->cpu != cpuid()) {
+      c->nmigrate++;
+    }
+    p->cpu = cpuid();
+    p->state = PROC_RUNNING;
+    c->proc = p;
+    c->nswitch++;
+
+    printf("[scheduler] cpu %d switch to pid=%d (%s)\n",
+           cpuid(), p->pid, p->name);
+
+    // 切到线程上下文；等线程 yield 或 exit 再切回 c->context
+    swtch(&c->context, &p->context);
+
+    // 回到这里说明线程主动让出了 CPU（yield 或 exit）。
+    // 它的寄存器这时才保存好：让出的线程现在才能放回队列（否则别的 CPU 可能
+    // 从旧的 context 把它跑起来），退出的线程现在才能释放内核栈（刚才还在用）
+    c->proc = 0;
+    if (p->state == PROC_RUNNABLE) {
+      enqueue(c, p);
+    } else if (p->state == PROC_ZOMBIE && p->kstack) {
+      free_pages((void *)p->kstack, KSTACK_ORDER);
+      p->kstack = 0;
+    }
   }
 
   printf("[scheduler] no runnable procs, return\n");
 }
 
-// 线程主动让出 CPU（协作式调度）
+// 线程主动让出 CPU（协作式调度）：切回调度器后由它排到本 CPU 就绪队列尾部
 void
 yield(void)
 {
-  if (current_proc == 0) {
+  struct proc *p = myproc();
+  if (p == 0) {
     return; // 还没进入 scheduler，就忽略
   }
 
-  struct proc *p = current_proc;
+  struct cpu *c = mycpu();
   p->state = PROC_RUNNABLE;
 
   printf("[yield] pid=%d (%s)\n", p->pid, p->name);
 
-  swtch(&p->context, &sched_context);
+  swtch(&p->context, &c->context);
 }
 
-// 线程退出：标记 ZOMBIE，释放栈，切回调度器
+// 线程退出：标记 ZOMBIE，切回调度器（内核栈还在用，由调度器释放）
 void
 kproc_exit(void)
 {
-  if (current_proc == 0) {
-    panic("kproc_exit: no current_proc");
+  struct proc *p = myproc();
+  if (p == 0) {
+    panic("kproc_exit: no current proc");
   }
 
-  struct proc *p = current_proc;
   printf("[kproc_exit] pid=%d (%s)\n", p->pid, p->name);
 
   p->state = PROC_ZOMBIE;
 
-  if (p->kstack) {
-    free_page((void *)p->kstack);
-    p->kstack = 0;
-  }
-
-  swtch(&p->context, &sched_context);
+  swtch(&p->context, &mycpu()->context);
 
   // 不该再回来
   panic("kproc_exit: returned");
 }
+
+// 打印每个 CPU 的调度统计
+void
+debug_sched_state(void)
+{
+  printf("=== Scheduler State ===\n");
+  for (int i = 0; i < NCPU; i++) {
+    struct cpu *c = &cpus[i];
+    printf("cpu %d: runnable=%d switches=%lu steals=%lu stolen=%lu migrations=%lu\n",
+           i, c->rq.count, c->nswitch, c->nsteal, c->nstolen, c->nmigrate);
+  }
+}
@@ -0,0 +1,79 @@
+// kernel/rcu.c
+// epoch 式 RCU：全局 epoch 只在 synchronize_rcu() 时递增；
+// 每个 CPU 在进入最外层读侧临界区时记下当时的 epoch，离开时清零。
+// 写者递增 epoch 后，只需等待记录值非零且小于新 epoch 的 CPU。
+
+#include "types.h"
+#include "riscv.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "rcu.h"
+
+// 每个 CPU 一条 cache line，读者只写自己的那一条
+struct rcu_cpu {
+    volatile uint64 epoch;   // 0：不在读侧临界区；否则为进入时的全局 epoch
+    int nesting;             // 读侧临界区嵌套深度
+} __attribute__((aligned(64)));
+
+static struct rcu_cpu rcu_cpus[NCPU];
+
+// 全局 epoch 从 1 开始，0 保留给“静止状态”
+static volatile uint64 rcu_epoch = 1;
+
+void
+rcu_read_lock(void)
+{
+    push_off();   // 读侧临界区内不能被调度走，也不能迁移到别的 CPU
+
+    struct rcu_cpu *rc = &rcu_cpus[cpuid()];
+    if (rc->nesting++ == 0) {
+        __atomic_store_n(&rc->epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        // 先公布“我在读”，再去读共享数据
+        __sync_synchronize();
+    }
+}
+
+void
+rcu_read_unlock(void)
+{
+    struct rcu_cpu *rc = &rcu_cpus[cpuid()];
+
+    if (rc->nesting < 1) {
+        panic("rcu_read_unlock: not in read section");
+    }
+    if (--rc->nesting == 0) {
+        // 读侧对共享数据的访问必须在“离开”之前完成
+        __atomic_store_n(&rc->epoch, 0, __ATOMIC_RELEASE);
+    }
+
+    pop_off();
+}
+
+// 等待一个宽限期：调用前已在读侧临界区中的 CPU 都离开之后才返回。
+// 调用者可以持有自旋锁，但自己不能处于读侧临界区。
+void
+synchronize_rcu(void)
+{
+    int me = cpuid();
+
+    if (rcu_cpus[me].nesting > 0) {
+        panic("synchronize_rcu: inside read section");
+    }
+
+    // 摘链等修改必须先于新 epoch 对读者可见
+    uint64 target = __atomic_add_fetch(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < NCPU; i++) {
+        if (i == me) {
+            continue;
+        }
+        for (;;) {
+            uint64 e = __atomic_load_n(&rcu_cpus[i].epoch, __ATOMIC_ACQUIRE);
+            if (e == 0 || e >= target) {
+                break;   // 静止，或者是在新 epoch 之后才进入的读者
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+// kernel/rwlock.c
+// 读写自旋锁实现：cnt 一个字同时编码“读者数量 / 写者持有”，
+// 读者用 CAS 加一，写者用 CAS 把 0 改成 -1。
+
+#include "types.h"
+#include "riscv.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "rwlock.h"
+
+void
+initrwlock(struct rwspinlock *lk, char *name)
+{
+    lk->name        = name;
+    lk->cnt         = 0;
+    lk->wwait       = 0;
+    lk->wcpu        = 0;
+    lk->nwrite      = 0;
+    lk->ncontended  = 0;
+    lk->spin_cycles = 0;
+}
+
+void
+read_acquire(struct rwspinlock *lk)
+{
+    push_off();
+
+    if (write_holding(lk)) {
+        panic("read_acquire: holding write lock");
+    }
+
+    for (;;) {
+        int c = __atomic_load_n(&lk->cnt, __ATOMIC_RELAXED);
+        if (c >= 0 && __atomic_load_n(&lk->wwait, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&lk->cnt, &c, c + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        // busy wait：有写者持有或在等待
+    }
+}
+
+void
+read_release(struct rwspinlock *lk)
+{
+    if (__atomic_fetch_sub(&lk->cnt, 1, __ATOMIC_RELEASE) <= 0) {
+        panic("read_release: not read-locked");
+    }
+    pop_off();
+}
+
+void
+write_acquire(struct rwspinlock *lk)
+{
+    push_off();
+
+    if (write_holding(lk)) {
+        panic("write_acquire: already holding");
+    }
+
+    int zero = 0;
+    if (__atomic_compare_exchange_n(&lk->cnt, &zero, -1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        lk->wcpu = mycpu();
+        lk->nwrite++;
+        return;
+    }
+
+    // 慢路径：登记为等待写者，挡住新来的读者，等现有读者退出
+    uint64 t0 = r_time();
+    __atomic_fetch_add(&lk->wwait, 1, __ATOMIC_RELAXED);
+    for (;;) {
+        zero = 0;
+        if (__atomic_compare_exchange_n(&lk->cnt, &zero, -1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    __atomic_fetch_sub(&lk->wwait, 1, __ATOMIC_RELAXED);
+
+    lk->wcpu = mycpu();
+    lk->nwrite++;
+    lk->ncontended++;
+    lk->spin_cycles += r_time() - t0;
+}
+
+void
+write_release(struct rwspinlock *lk)
+{
+    if (!write_holding(lk)) {
+        panic("write_release: not holding");
+    }
+    lk->wcpu = 0;
+    __atomic_store_n(&lk->cnt, 0, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+int
+write_holding(struct rwspinlock *lk)
+{
+    return lk->cnt == -1 && lk->wcpu == mycpu();
+}
@@ -0,0 +1,404 @@
+// kernel/slab.c
+// slab 分配器 + kmalloc：在伙伴系统之上为小对象提供按类型缓存的分配。
+//
+// slab 布局（占 2^order 页，首地址按块大小对齐）：
+//   [struct slab][uint16 freestack[nobjs]][对齐填充][obj0][obj1]...
+// 空闲对象用 slab 头后面的下标栈管理，不在对象内部写链接指针，
+// 这样对象释放后仍保持构造函数初始化过的状态。
+
+#include "types.h"
+#include "memlayout.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "pmm.h"
+#include "slab.h"
+
+struct slab {
+    struct kmem_cache *cache;   // 所属 cache
+    struct slab *next;          // 所在链表（partial/full/empty）
+    struct slab *prev;
+    uint32 inuse;               // 已分配出去的对象数
+    uint32 nfree;               // freestack 中的空闲下标数
+    uint16 freestack[];         // 空闲对象下标栈
+};
+
+#define NKMEMCACHE     32
+#define SLAB_MAX_ORDER 3        // 单个 slab 最多 8 页
+#define SLAB_MIN_OBJS  8        // 尽量让每个 slab 至少容纳这么多对象
+
+static struct spinlock cache_table_lock;
+static struct kmem_cache caches[NKMEMCACHE];
+static int ncaches = 0;
+
+// kmalloc 的尺寸分级：16, 32, ..., KMALLOC_MAX
+#define KMALLOC_NCLASS 8
+static struct kmem_cache *kmalloc_caches[KMALLOC_NCLASS];
+
+static const char *kmalloc_names[KMALLOC_NCLASS] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static uint32
+align_up(uint32 x, uint32 a)
+{
+    return (x + a - 1) & ~(a - 1);
+}
+
+static void
+kstrncpy(char *dst, const char *src, int n)
+{
+    int i = 0;
+    for (; i < n - 1 && src[i]; i++) {
+        dst[i] = src[i];
+    }
+    dst[i] = 0;
+}
+
+// ------------ slab 链表操作（调用者持有 c->lock） ------------
+
+static void
+slab_list_add(struct slab **head, struct slab *s)
+{
+    s->prev = 0;
+    s->next = *head;
+    if (*head) {
+        (*head)->prev = s;
+    }
+    *head = s;
+}
+
+static void
+slab_list_del(struct slab **head, struct slab *s)
+{
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *head = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+    s->next = s->prev = 0;
+}
+
+static void *
+slab_obj(struct kmem_cache *c, struct slab *s, uint32 idx)
+{
+    return (char *)s + c->offset + idx * c->objsize;
+}
+
+// 按 order 计算 slab 能放下多少对象，并写回第一个对象的偏移
+static uint32
+slab_layout(uint32 objsize, uint32 align, int order, uint32 *offset)
+{
+    uint32 slabsize = PGSIZE << order;
+    uint32 n = (slabsize - sizeof(struct slab)) / (objsize + sizeof(uint16));
+
+    while (n > 0) {
+        uint32 off = align_up(sizeof(struct slab) + n * sizeof(uint16), align);
+        if (off + n * objsize <= slabsize) {
+            *offset = off;
+            return n;
+        }
+        n--;
+    }
+    return 0;
+}
+
+// 新建一个 slab：向伙伴系统要页，初始化空闲栈并对每个对象调用构造函数
+static struct slab *
+slab_grow(struct kmem_cache *c)
+{
+    struct slab *s = (struct slab *)alloc_pages_tag(c->order, MT_SLAB);
+    if (s == 0) {
+        return 0;
+    }
+    pmm_set_slab(s, 1);
+
+    s->cache = c;
+    s->next  = s->prev = 0;
+    s->inuse = 0;
+    s->nfree = c->nobjs;
+    for (uint32 i = 0; i < c->nobjs; i++) {
+        // 倒序压栈，分配时从下标 0 开始
+        s->freestack[i] = (uint16)(c->nobjs - 1 - i);
+        if (c->ctor) {
+            c->ctor(slab_obj(c, s, i));
+        }
+    }
+
+    c->nslabs++;
+    return s;
+}
+
+static void
+slab_destroy(struct kmem_cache *c, struct slab *s)
+{
+    pmm_set_slab(s, 0);
+    free_pages(s, c->order);
+    c->nslabs--;
+}
+
+// 从 slab 中取一个对象（调用者持有 c->lock）
+static void *
+cache_alloc_locked(struct kmem_cache *c)
+{
+    struct slab *s = c->partial;
+
+    if (s == 0) {
+        if ((s = c->empty) != 0) {
+            slab_list_del(&c->empty, s);
+        } else if ((s = slab_grow(c)) == 0) {
+            return 0;
+        }
+        slab_list_add(&c->partial, s);
+    }
+
+    uint32 idx = s->freestack[--s->nfree];
+    s->inuse++;
+    if (s->nfree == 0) {
+        slab_list_del(&c->partial, s);
+        slab_list_add(&c->full, s);
+    }
+
+    c->nactive++;
+    return slab_obj(c, s, idx);
+}
+
+// 把对象还给它所在的 slab（调用者持有 c->lock）
+static void
+cache_free_locked(struct kmem_cache *c, void *obj)
+{
+    struct slab *s = (struct slab *)((uint64)obj & ~((uint64)(PGSIZE << c->order) - 1));
+    uint32 off = (uint32)((char *)obj - (char *)s);
+
+    if (s->cache != c || off < c->offset || (off - c->offset) % c->objsize != 0) {
+        panic("kmem_cache_free: bad object");
+    }
+
+    int was_full = (s->nfree == 0);
+    s->freestack[s->nfree++] = (uint16)((off - c->offset) / c->objsize);
+    s->inuse--;
+    c->nactive--;
+
+    if (was_full) {
+        slab_list_del(&c->full, s);
+        slab_list_add(&c->partial, s);
+    }
+    if (s->inuse == 0) {
+        slab_list_del(&c->partial, s);
+        if (c->empty == 0) {
+            slab_list_add(&c->empty, s);   // 留一个空 slab，避免反复向伙伴系统申请
+        } else {
+            slab_destroy(c, s);
+        }
+    }
+}
+
+// ------------ 对外接口 ------------
+
+struct kmem_cache *
+kmem_cache_create(const char *name, uint32 size, uint32 align, void (*ctor)(void *))
+{
+    if (align == 0) {
+        align = 8;
+    }
+    if (size == 0 || (align & (align - 1)) != 0) {
+        return 0;
+    }
+
+    uint32 objsize = align_up(size, align);
+
+    // 选最小的 order，使每个 slab 至少放下 SLAB_MIN_OBJS 个对象
+    int order = 0;
+    uint32 offset = 0;
+    uint32 nobjs = slab_layout(objsize, align, order, &offset);
+    while (nobjs < SLAB_MIN_OBJS && order < SLAB_MAX_ORDER) {
+        order++;
+        nobjs = slab_layout(objsize, align, order, &offset);
+    }
+    if (nobjs == 0) {
+        return 0;   // 对象太大，应直接用 alloc_pages
+    }
+
+    acquire(&cache_table_lock);
+    if (ncaches >= NKMEMCACHE) {
+        release(&cache_table_lock);
+        return 0;
+    }
+    struct kmem_cache *c = &caches[ncaches++];
+    release(&cache_table_lock);
+
+    kstrncpy(c->name, name ? name : "cache", sizeof(c->name));
+    c->objsize = objsize;
+    c->align   = align;
+    c->order   = order;
+    c->nobjs   = nobjs;
+    c->offset  = offset;
+    c->ctor    = ctor;
+    initlock(&c->lock, "kmem_cache");
+    c->partial = c->full = c->empty = 0;
+    c->nslabs  = 0;
+    c->nactive = 0;
+    for (int i = 0; i < NCPU; i++) {
+        c->mag[i].count = 0;
+    }
+    return c;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+    void *obj = 0;
+
+    push_off();
+    struct kmem_magazine *m = &c->mag[cpuid()];
+
+    if (m->count == 0) {
+        // 弹匣空了：一次性从 slab 里装半匣
+        acquire(&c->lock);
+        while (m->count < SLAB_MAG_SIZE / 2) {
+            void *o = cache_alloc_locked(c);
+            if (o == 0) {
+                break;
+            }
+            m->objs[m->count++] = o;
+        }
+        release(&c->lock);
+    }
+    if (m->count > 0) {
+        obj = m->objs[--m->count];
+    }
+
+    pop_off();
+    return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+    if (obj == 0) {
+        return;
+    }
+
+    push_off();
+    struct kmem_magazine *m = &c->mag[cpuid()];
+
+    if (m->count == SLAB_MAG_SIZE) {
+        // 弹匣满了：把一半退回 slab
+        acquire(&c->lock);
+        while (m->count > SLAB_MAG_SIZE / 2) {
+            cache_free_locked(c, m->objs[--m->count]);
+        }
+        release(&c->lock);
+    }
+    m->objs[m->count++] = obj;
+
+    pop_off();
+}
+
+void
+kmem_cache_shrink(struct kmem_cache *c)
+{
+    push_off();
+    struct kmem_magazine *m = &c->mag[cpuid()];
+
+    acquire(&c->lock);
+    while (m->count > 0) {
+        cache_free_locked(c, m->objs[--m->count]);
+    }
+    if (c->empty) {
+        struct slab *s = c->empty;
+        slab_list_del(&c->empty, s);
+        slab_destroy(c, s);
+    }
+    release(&c->lock);
+
+    pop_off();
+}
+
+// ------------ kmalloc / kfree ------------
+
+void
+slab_init(void)
+{
+    initlock(&cache_table_lock, "kmem_caches");
+    ncaches = 0;
+
+    for (int i = 0; i < KMALLOC_NCLASS; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], KMALLOC_MIN << i,
+                                              KMALLOC_MIN, 0);
+        if (kmalloc_caches[i] == 0) {
+            panic("slab_init: kmalloc cache");
+        }
+    }
+    printf("slab_init: %d kmalloc caches (%d..%d bytes)\n",
+           KMALLOC_NCLASS, KMALLOC_MIN, KMALLOC_MAX);
+}
+
+void *
+kmalloc(uint64 size)
+{
+    if (size == 0) {
+        return 0;
+    }
+
+    if (size > KMALLOC_MAX) {
+        int order = 0;
+        while ((uint64)(PGSIZE << order) < size) {
+            order++;
+            if (order >= MAX_ORDER) {
+                return 0;
+            }
+        }
+        return alloc_pages_tag(order, MT_KMALLOC);
+    }
+
+    int cls = 0;
+    while ((uint64)(KMALLOC_MIN << cls) < size) {
+        cls++;
+    }
+    return kmem_cache_alloc(kmalloc_caches[cls]);
+}
+
+void
+kfree(void *p)
+{
+    if (p == 0) {
+        return;
+    }
+
+    int order;
+    void *head = pmm_block_head(p, &order);
+    if (head == 0) {
+        panic("kfree: not an allocated address");
+    }
+
+    if (pmm_is_slab(head)) {
+        struct slab *s = (struct slab *)head;
+        kmem_cache_free(s->cache, p);
+    } else {
+        if (head != p) {
+            panic("kfree: pointer into the middle of a block");
+        }
+        free_pages(p, order);
+    }
+}
+
+void
+debug_slab_state(void)
+{
+    printf("=== Slab Caches ===\n");
+    for (int i = 0; i < ncaches; i++) {
+        struct kmem_cache *c = &caches[i];
+        int cached = 0;
+        for (int j = 0; j < NCPU; j++) {
+            cached += c->mag[j].count;
+        }
+        printf("%s: objsize=%u order=%d objs/slab=%u slabs=%u active=%u in_magazines=%d\n",
+               c->name, c->objsize, c->order, c->nobjs, (uint32)c->nslabs,
+               (uint32)c->nactive, cached);
+    }
+}
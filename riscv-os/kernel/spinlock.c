@@ -0,0 +1,172 @@
+// kernel/spinlock.c
+// 自旋锁实现：
+//  - push_off/pop_off 管理可嵌套的关中断，内层 release 不会提前开中断
+//  - 记录持有者 CPU，holding() 只对当前 CPU 返回真
+//  - 获取/释放带内存屏障，保证临界区内的读写不会被重排到锁外
+//  - 每把锁记录获取次数、竞争次数和自旋周期，debug_lock_stats() 统一打印
+
+#include "types.h"
+#include "riscv.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "proc.h"
+
+// 已注册锁的表，只用于 debug_lock_stats() 汇总打印
+#define NLOCKTAB 256
+
+static struct spinlock *locktab[NLOCKTAB];
+static int nlocktab = 0;
+
+static int
+streq_local(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+    lk->name        = name;
+    lk->locked      = 0;
+    lk->cpu         = 0;
+    lk->nacquire    = 0;
+    lk->ncontended  = 0;
+    lk->spin_cycles = 0;
+
+    // 同一把锁可能被反复初始化（例如 proc_init 在每个测试前都会调用）
+    for (int i = 0; i < nlocktab; i++) {
+        if (locktab[i] == lk) {
+            return;
+        }
+    }
+    if (nlocktab < NLOCKTAB) {
+        locktab[nlocktab++] = lk;
+    }
+}
+
+// 加锁：关中断（可嵌套）+ 自旋等待 locked 变为 0
+void
+acquire(struct spinlock *lk)
+{
+    push_off();   // 关闭中断，避免在持锁期间被同一 CPU 上的中断处理程序死锁
+
+    if (holding(lk)) {
+        panic("acquire: already holding");
+    }
+
+    uint64 t0 = 0;
+    int contended = 0;
+
+    // test-and-test-and-set：等待期间只读 locked，减少总线上的写请求
+    while (atomic_xchg(&lk->locked, 1) != 0) {
+        if (!contended) {
+            contended = 1;
+            t0 = r_time();
+        }
+        while (lk->locked) {
+            // busy wait
+        }
+    }
+
+    // 之后对临界区的访问不能被重排到获取锁之前
+    __sync_synchronize();
+
+    lk->cpu = mycpu();
+    lk->nacquire++;
+    if (contended) {
+        lk->ncontended++;
+        lk->spin_cycles += r_time() - t0;
+    }
+}
+
+// 解锁：清除持有者 + 释放标志位 + 按嵌套层数恢复中断
+void
+release(struct spinlock *lk)
+{
+    if (!holding(lk)) {
+        panic("release: not holding");
+    }
+
+    lk->cpu = 0;
+
+    // 临界区内的写入必须在释放锁之前对其它 CPU 可见
+    __sync_synchronize();
+    __sync_lock_release(&lk->locked);
+
+    pop_off();
+}
+
+// 当前 CPU 是否持有该锁
+int
+holding(struct spinlock *lk)
+{
+    return lk->locked && lk->cpu == mycpu();
+}
+
+void
+push_off(void)
+{
+    int old = intr_get();
+
+    intr_off();
+    struct cpu *c = mycpu();
+    if (c->noff == 0) {
+        c->intena = old;
+    }
+    c->noff++;
+}
+
+void
+pop_off(void)
+{
+    struct cpu *c = mycpu();
+
+    if (intr_get()) {
+        panic("pop_off: interruptible");
+    }
+    if (c->noff < 1) {
+        panic("pop_off: unbalanced");
+    }
+    c->noff--;
+    if (c->noff == 0 && c->intena) {
+        intr_on();
+    }
+}
+
+void
+debug_lock_stats(void)
+{
+    printf("=== Spinlock Statistics ===\n");
+    for (int i = 0; i < nlocktab; i++) {
+        struct spinlock *lk = locktab[i];
+
+        // 同名的锁（如每个 buf 的 sleeplock）合并成一行，只在第一次出现时打印
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            if (streq_local(locktab[j]->name, lk->name)) {
+                seen = 1;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+
+        int count = 0;
+        uint64 acq = 0, cont = 0, cycles = 0;
+        for (int j = i; j < nlocktab; j++) {
+            if (streq_local(locktab[j]->name, lk->name)) {
+                count++;
+                acq    += locktab[j]->nacquire;
+                cont   += locktab[j]->ncontended;
+                cycles += locktab[j]->spin_cycles;
+            }
+        }
+        printf("%s x%d: acquires=%lu contended=%lu spin_cycles=%lu\n",
+               lk->name, count, acq, cont, cycles);
+    }
+}
@@ -1,13 +1,19 @@
 #include "types.h"
 #include "riscv.h"
+#include "fdt.h"
 
 void main(void);
 static void timerinit(void);
 
-// entry.S 在 M 模式下跳到这里
+// entry.S 在 M 模式下跳到这里；a0/a1 是 QEMU 复位代码传来的 hartid 和设备树地址
 void
-start(void)
+start(uint64 hartid, uint64 dtb)
 {
+    (void)hartid;
+
+    // 0. 记下设备树地址，pmm_init 用它确定物理内存大小
+    boot_dtb = dtb;
+
     // 1. M Previous Privilege 模式设置为 S，用于 mret
     unsigned long x = r_mstatus();
     x &= ~MSTATUS_MPP_MASK;
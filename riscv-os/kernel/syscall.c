@@ -3,8 +3,10 @@
 #include "types.h"
 #include "printf.h"
 #include "proc.h"
+#include "vm.h"
 
-// 当前正在处理的系统调用帧（模拟 trapframe 中的 a0~a7）
+// 当前正在处理的系统调用帧：用户进程的是 trapframe 里的 a0~a7，
+// 测试代码直接调用时是它自己构造的帧。
 // 因为当前内核是单核 + 无并发，这里用一个全局指针就够了。
 static struct syscall_frame *cur_frame = 0;
 
@@ -43,8 +45,8 @@ argaddr(int n, uint64 *ip)
     *ip = argraw(n);
 }
 
-// 取字符串参数：当前实验中还没有真正的用户地址空间，
-// 直接把 addr 当成内核里的指针来用。
+// 取字符串参数：用户进程从它的页表里 copyinstr；
+// 内核线程（测试代码直接调 syscall()）没有用户页表，addr 就是内核指针。
 int
 argstr(int n, char *buf, int max)
 {
@@ -52,7 +54,14 @@ argstr(int n, char *buf, int max)
     argaddr(n, &addr);
     const char *src = (const char *)addr;
 
-    if (src == 0 || max <= 0) {
+    if (max <= 0) {
+        return -1;
+    }
+    struct proc *p = myproc();
+    if (p && p->pagetable) {
+        return copyinstr(p->pagetable, buf, addr, max);
+    }
+    if (src == 0) {
         return -1;
     }
 
@@ -73,6 +82,9 @@ extern uint64 sys_uptime(void);
 extern uint64 sys_pause(void);
 extern uint64 sys_test_add(void);
 extern uint64 sys_test_str(void);
+extern uint64 sys_exit(void);
+extern uint64 sys_fork(void);
+extern uint64 sys_sbrk(void);
 
 // ---- 实验 7：从 sysfile.c 提供的文件相关 sys_* 实现 ----
 extern uint64 sys_open(void);
@@ -81,6 +93,20 @@ extern uint64 sys_write(void);
 extern uint64 sys_close(void);
 extern uint64 sys_fstat(void);
 extern uint64 sys_dup(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_copy_file_range(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_reflink(void);
+extern uint64 sys_fallocate(void);
 
 // syscalls[] 表：根据系统调用号索引到函数指针
 typedef uint64 (*syscall_func_t)(void);
@@ -98,6 +124,24 @@ static syscall_func_t syscalls[] = {
     [SYS_close]    = sys_close,
     [SYS_fstat]    = sys_fstat,
     [SYS_dup]      = sys_dup,
+
+    [SYS_exit]     = sys_exit,
+    [SYS_fork]     = sys_fork,
+    [SYS_sbrk]     = sys_sbrk,
+    [SYS_mmap]     = sys_mmap,
+    [SYS_munmap]   = sys_munmap,
+    [SYS_msync]    = sys_msync,
+    [SYS_fsync]    = sys_fsync,
+    [SYS_fdatasync] = sys_fdatasync,
+    [SYS_sync]     = sys_sync,
+    [SYS_readv]    = sys_readv,
+    [SYS_writev]   = sys_writev,
+    [SYS_pread]    = sys_pread,
+    [SYS_pwrite]   = sys_pwrite,
+    [SYS_copy_file_range] = sys_copy_file_range,
+    [SYS_sendfile] = sys_sendfile,
+    [SYS_reflink]  = sys_reflink,
+    [SYS_fallocate] = sys_fallocate,
 };
 
 // syscall 分发入口：
@@ -115,8 +159,8 @@ syscall(struct syscall_frame *f)
         syscalls[num] != 0) {
         ret = syscalls[num]();
     } else {
-        printf("pid %d: unknown syscall %d\n",
-               current_proc ? current_proc->pid : -1, num);
+        struct proc *p = myproc();
+        printf("pid %d: unknown syscall %d\n", p ? p->pid : -1, num);
         ret = (uint64)-1;
     }
 
@@ -7,6 +7,12 @@
 //   - close
 //   - fstat
 //   - dup
+//   - mmap / munmap / msync（用户进程的文件映射，具体实现在 mmap.c）
+//   - fsync / fdatasync / sync（write 只写到页缓存，要落盘得显式要求，见 writeback.c）
+//   - readv / writev / pread / pwrite
+//   - copy_file_range / sendfile（数据在内核里从页缓存拷到页缓存）
+//   - reflink（克隆文件，共享数据块）
+//   - fallocate（预分配、打洞）
 //
 // 注意：
 // 1. 这里不依赖 struct proc 里的 ofile[]/cwd/pagetable，
@@ -22,6 +28,10 @@
 #include "file.h"     // struct file / filealloc / fileread / filewrite 等
 #include "fcntl.h"    // O_RDONLY/O_WRONLY/O_RDWR/O_CREATE/O_TRUNC
 #include "stat.h"     // struct stat
+#include "proc.h"     // myproc
+#include "mman.h"     // PROT_xxx / MAP_xxx / mmap_region 等
+#include "uio.h"      // struct iovec / IOV_MAX
+#include "rwlock.h"   // g_ofile 的读写锁
 
 // ---------- 简化版：全局文件描述符表 ----------
 
@@ -35,10 +45,22 @@
 // 对于当前“单内核线程测试”的场景已经够用。
 static struct file *g_ofile[NOFILE];
 
+// 几乎每个系统调用都要按 fd 查一次表（读），只有 open/dup/close 改它（写）。
+static struct rwspinlock ofile_lock;
+
+// 初始化 fd 表的锁（fs_init 里紧跟 fileinit 调用）
+void
+sysfileinit(void)
+{
+    initrwlock(&ofile_lock, "ofile");
+}
+
 // 从第 n 个系统调用参数中取 fd，返回对应的 struct file*
 // n: 第几个 syscall 参数（0 开始）
 // pfd: 如非空，写回 fd 数值
-// pf:  如非空，写回 struct file*
+// pf:  写回 struct file*
+// 成功时 *pf 多持有一个引用（在读锁内 filedup），
+// 这样别人同时 close 这个 fd 也不会把 file 释放掉；用完必须 fileclose(*pf)。
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -48,16 +70,23 @@ argfd(int n, int *pfd, struct file **pf)
     // 从 syscall 的第 n 个参数中取一个 int
     argint(n, &fd);
 
-    if (fd < 0 || fd >= NOFILE || (f = g_ofile[fd]) == 0) {
+    if (fd < 0 || fd >= NOFILE) {
+        return -1;
+    }
+    read_acquire(&ofile_lock);
+    f = g_ofile[fd];
+    if (f) {
+        filedup(f);
+    }
+    read_release(&ofile_lock);
+    if (f == 0) {
         return -1;
     }
 
     if (pfd) {
         *pfd = fd;
     }
-    if (pf) {
-        *pf = f;
-    }
+    *pf = f;
     return 0;
 }
 
@@ -65,15 +94,32 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
+    write_acquire(&ofile_lock);
     for (int fd = 0; fd < NOFILE; fd++) {
         if (g_ofile[fd] == 0) {
             g_ofile[fd] = f;
+            write_release(&ofile_lock);
             return fd;
         }
     }
+    write_release(&ofile_lock);
     return -1;
 }
 
+// 取两个 fd 参数（第 n1、n2 个），两个都带引用；任一个无效就都不拿
+static int
+argfd2(int n1, struct file **pf1, int n2, struct file **pf2)
+{
+    if (argfd(n1, 0, pf1) < 0) {
+        return -1;
+    }
+    if (argfd(n2, 0, pf2) < 0) {
+        fileclose(*pf1);
+        return -1;
+    }
+    return 0;
+}
+
 // ---------- 内部辅助：创建文件（或复用已有文件） ----------
 
 // 在路径 path 处创建一个新的 inode：type = T_FILE/T_DIR，major/minor 给设备用。
@@ -176,13 +222,14 @@ sys_dup(void)
     struct file *f;
     int fd;
 
+    // argfd 拿到的引用直接交给新的 fd
     if (argfd(0, 0, &f) < 0) {
         return (uint64)-1;
     }
     if ((fd = fdalloc(f)) < 0) {
+        fileclose(f);
         return (uint64)-1;
     }
-    filedup(f);
     return (uint64)fd;
 }
 
@@ -201,7 +248,9 @@ sys_read(void)
     argaddr(1, &p);
     argint(2, &n);
 
-    return (uint64)fileread(f, p, n);
+    int r = fileread(f, p, n);
+    fileclose(f);
+    return (uint64)r;
 }
 
 // write(fd, buf, n)
@@ -218,7 +267,9 @@ sys_write(void)
     argaddr(1, &p);
     argint(2, &n);
 
-    return (uint64)filewrite(f, p, n);
+    int r = filewrite(f, p, n);
+    fileclose(f);
+    return (uint64)r;
 }
 
 // close(fd)
@@ -232,11 +283,19 @@ sys_close(void)
         return (uint64)-1;
     }
 
-    // 从全局 fd 表中清除，再真正关闭 file 对象
-    g_ofile[fd] = 0;
-    fileclose(f);
+    // 从全局 fd 表中清除，再放掉表项持有的引用（别人已经先关掉了就不再放）
+    write_acquire(&ofile_lock);
+    int mine = g_ofile[fd] == f;
+    if (mine) {
+        g_ofile[fd] = 0;
+    }
+    write_release(&ofile_lock);
+    if (mine) {
+        fileclose(f);
+    }
+    fileclose(f);   // argfd 的引用
 
-    return 0;
+    return mine ? 0 : (uint64)-1;
 }
 
 // fstat(fd, struct stat *st)
@@ -252,7 +311,9 @@ sys_fstat(void)
     }
     argaddr(1, &addr);
 
-    return (uint64)filestat(f, addr);
+    int r = filestat(f, addr);
+    fileclose(f);
+    return (uint64)r;
 }
 
 // open(path, omode)
@@ -338,3 +399,330 @@ sys_open(void)
 
     return (uint64)fd;
 }
+
+// mmap(addr, len, prot, flags, fd, off) -> 映射起点，失败返回 -1
+// addr 只能是 0（由内核挑地址）；只有用户进程能用。
+uint64
+sys_mmap(void)
+{
+    uint64 addr, len, off;
+    int prot, flags;
+    struct file *f;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    if (argfd(4, 0, &f) < 0) {
+        return (uint64)-1;
+    }
+    argaddr(5, &off);
+
+    // 映射成功时 VMA 自己再 filedup 一次
+    struct proc *p = myproc();
+    uint64 r = (uint64)-1;
+    if (p != 0 && p->pagetable != 0 && addr == 0) {
+        r = mmap_region(p, len, prot, flags, f, off);
+    }
+    fileclose(f);
+    return r;
+}
+
+// munmap(addr, len)：MAP_SHARED 的脏页先写回文件
+uint64
+sys_munmap(void)
+{
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    struct proc *p = myproc();
+    if (p == 0 || p->pagetable == 0) {
+        return (uint64)-1;
+    }
+    return (uint64)munmap_region(p, addr, len);
+}
+
+// msync(addr, len)：把范围内 MAP_SHARED 的脏页写回文件
+uint64
+sys_msync(void)
+{
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    struct proc *p = myproc();
+    if (p == 0 || p->pagetable == 0) {
+        return (uint64)-1;
+    }
+    return (uint64)msync_region(p, addr, len);
+}
+
+static uint64
+do_fsync(int datasync)
+{
+    struct file *f;
+
+    if (argfd(0, 0, &f) < 0) {
+        return (uint64)-1;
+    }
+    int r = 0;   // 设备没有缓存
+    if (f->type == FD_INODE) {
+        r = writeback_fsync(f->ip, datasync);
+    }
+    fileclose(f);
+    return r < 0 ? (uint64)-1 : 0;
+}
+
+// fsync(fd)：把该文件的脏页和 inode 写回，等它的改动提交，返回时数据和元数据都已落盘
+uint64
+sys_fsync(void)
+{
+    return do_fsync(0);
+}
+
+// fdatasync(fd)：同 fsync，但只改了 nlink 之类和读数据无关的元数据时不提交日志
+uint64
+sys_fdatasync(void)
+{
+    return do_fsync(1);
+}
+
+// sync()：写回所有脏文件并提交日志
+uint64
+sys_sync(void)
+{
+    writeback_sync();
+    return 0;
+}
+
+// 取第 n 个参数指向的 iovec 数组（个数在第 n+1 个参数）拷进 iov，
+// 检查段数和总长度，返回段数，出错返回 -1
+static int
+argiov(int n, struct iovec *iov)
+{
+    uint64 uiov;
+    int cnt;
+
+    argaddr(n, &uiov);
+    argint(n + 1, &cnt);
+    if (cnt < 0 || cnt > IOV_MAX) {
+        return -1;
+    }
+    if (either_copyin(iov, 1, uiov, cnt * sizeof(struct iovec)) < 0) {
+        return -1;
+    }
+
+    uint64 tot = 0;
+    for (int i = 0; i < cnt; i++) {
+        tot += iov[i].iov_len;
+        if (iov[i].iov_len > 0x7fffffff || tot > 0x7fffffff) {
+            return -1;   // 返回值是 int
+        }
+    }
+    return cnt;
+}
+
+// readv(fd, iov, iovcnt)
+uint64
+sys_readv(void)
+{
+    struct file *f;
+    struct iovec iov[IOV_MAX];
+
+    if (argfd(0, 0, &f) < 0) {
+        return (uint64)-1;
+    }
+    int cnt = argiov(1, iov);
+    int r = cnt < 0 ? -1 : filereadv(f, iov, cnt, -1);
+    fileclose(f);
+    return (uint64)r;
+}
+
+// writev(fd, iov, iovcnt)
+uint64
+sys_writev(void)
+{
+    struct file *f;
+    struct iovec iov[IOV_MAX];
+
+    if (argfd(0, 0, &f) < 0) {
+        return (uint64)-1;
+    }
+    int cnt = argiov(1, iov);
+    int r = cnt < 0 ? -1 : filewritev(f, iov, cnt, -1);
+    fileclose(f);
+    return (uint64)r;
+}
+
+// pread/pwrite 的公共部分：取 (fd, buf, n, off) 组成一段
+// 成功时 *pf 带着 argfd 的引用，用完要 fileclose
+static int
+argpio(struct file **pf, struct iovec *iov, int64 *off)
+{
+    int n;
+    uint64 o;
+
+    argaddr(1, &iov->iov_base);
+    argint(2, &n);
+    argaddr(3, &o);
+    if (n < 0 || o > 0xffffffffUL) {
+        return -1;   // 文件偏移是 32 位
+    }
+    if (argfd(0, 0, pf) < 0) {
+        return -1;
+    }
+    iov->iov_len = (uint64)n;
+    *off = (int64)o;
+    return 0;
+}
+
+// pread(fd, buf, n, off)
+uint64
+sys_pread(void)
+{
+    struct file *f;
+    struct iovec iov;
+    int64 off;
+
+    if (argpio(&f, &iov, &off) < 0) {
+        return (uint64)-1;
+    }
+    int r = filereadv(f, &iov, 1, off);
+    fileclose(f);
+    return (uint64)r;
+}
+
+// pwrite(fd, buf, n, off)
+uint64
+sys_pwrite(void)
+{
+    struct file *f;
+    struct iovec iov;
+    int64 off;
+
+    if (argpio(&f, &iov, &off) < 0) {
+        return (uint64)-1;
+    }
+    int r = filewritev(f, &iov, 1, off);
+    fileclose(f);
+    return (uint64)r;
+}
+
+// 取第 n 个参数：一个指向 64 位文件偏移的用户指针，0 表示“用文件自己的偏移”。
+// 非 0 时把偏移读进 *off，*uptr 记下指针，拷完再写回
+static int
+argoffp(int n, uint64 *uptr, uint32 *off)
+{
+    uint64 v;
+
+    argaddr(n, uptr);
+    if (*uptr == 0) {
+        return 0;
+    }
+    if (either_copyin(&v, 1, *uptr, sizeof(v)) < 0 || v > 0xffffffffUL) {
+        return -1;
+    }
+    *off = (uint32)v;
+    return 0;
+}
+
+static int
+putoffp(uint64 uptr, uint32 off)
+{
+    uint64 v = off;
+    if (uptr == 0) {
+        return 0;
+    }
+    return either_copyout(1, uptr, &v, sizeof(v));
+}
+
+// copy_file_range(fd_in, off_in, fd_out, off_out, len)
+uint64
+sys_copy_file_range(void)
+{
+    struct file *in, *out;
+    uint64 pin, pout;
+    uint32 offin, offout;
+    int len;
+
+    if (argoffp(1, &pin, &offin) < 0 || argoffp(3, &pout, &offout) < 0) {
+        return (uint64)-1;
+    }
+    argint(4, &len);
+    if (argfd2(0, &in, 2, &out) < 0) {
+        return (uint64)-1;
+    }
+
+    int r = filecopy(in, pin ? &offin : 0, out, pout ? &offout : 0, len);
+    fileclose(in);
+    fileclose(out);
+    if (r < 0 || putoffp(pin, offin) < 0 || putoffp(pout, offout) < 0) {
+        return (uint64)-1;
+    }
+    return (uint64)r;
+}
+
+// sendfile(out_fd, in_fd, offset, count)：offset 非 0 时从 *offset 读并更新它，
+// in_fd 的偏移不动；out_fd 总是从自己的偏移写
+uint64
+sys_sendfile(void)
+{
+    struct file *in, *out;
+    uint64 pin;
+    uint32 offin;
+    int count;
+
+    if (argoffp(2, &pin, &offin) < 0) {
+        return (uint64)-1;
+    }
+    argint(3, &count);
+    if (argfd2(0, &out, 1, &in) < 0) {
+        return (uint64)-1;
+    }
+
+    int r = filecopy(in, pin ? &offin : 0, out, 0, count);
+    fileclose(in);
+    fileclose(out);
+    if (r < 0 || putoffp(pin, offin) < 0) {
+        return (uint64)-1;
+    }
+    return (uint64)r;
+}
+
+// reflink(src_fd, dst_fd)：dst 原来的内容丢掉，变成和 src 共享数据块的克隆（类似 Linux 的 FICLONE）
+uint64
+sys_reflink(void)
+{
+    struct file *src, *dst;
+
+    if (argfd2(0, &src, 1, &dst) < 0) {
+        return (uint64)-1;
+    }
+    int r = filereflink(src, dst);
+    fileclose(src);
+    fileclose(dst);
+    return (uint64)r;
+}
+
+// fallocate(fd, mode, off, len)
+uint64
+sys_fallocate(void)
+{
+    struct file *f;
+    int mode;
+    uint64 off, len;
+
+    argint(1, &mode);
+    argaddr(2, &off);
+    argaddr(3, &len);
+    if (off > 0xffffffffUL || len > 0xffffffffUL) {
+        return (uint64)-1;   // 文件偏移是 32 位
+    }
+    if (argfd(0, 0, &f) < 0) {
+        return (uint64)-1;
+    }
+    int r = filefallocate(f, mode, (uint32)off, (uint32)len);
+    fileclose(f);
+    return (uint64)r;
+}
@@ -11,9 +11,10 @@ extern volatile uint64 ticks;
 uint64
 sys_getpid(void)
 {
-    if (current_proc == 0)
+    struct proc *p = myproc();
+    if (p == 0)
         return 0;
-    return (uint64)current_proc->pid;
+    return (uint64)p->pid;
 }
 
 // 返回自启动以来的 tick 数
@@ -61,3 +62,39 @@ sys_test_str(void)
     printf("[sys_test_str] got string: \"%s\"\n", buf);
     return (uint64)len;
 }
+
+// 用户进程退出：exit(status)，不返回
+uint64
+sys_exit(void)
+{
+    int n;
+    argint(0, &n);
+    struct proc *p = myproc();
+    if (p == 0 || p->pagetable == 0)
+        return (uint64)-1;   // 内核线程不能走这条路退出
+    uproc_exit(n);
+    return 0;  // 不会到这里
+}
+
+// fork()：父进程返回子进程 pid，子进程返回 0，失败返回 -1
+uint64
+sys_fork(void)
+{
+    return (uint64)(int64)uproc_fork();
+}
+
+// sbrk(n)：返回原来的 break，失败返回 -1
+uint64
+sys_sbrk(void)
+{
+    uint64 n;
+    argaddr(0, &n);
+    struct proc *p = myproc();
+    if (p == 0 || p->pagetable == 0)
+        return (uint64)-1;
+
+    uint64 old = p->sz;
+    if (proc_grow((int64)n) < 0)
+        return (uint64)-1;
+    return old;
+}
@@ -4,6 +4,7 @@
 #include "types.h"
 #include "memlayout.h"
 #include "pmm.h"
+#include "slab.h"
 #include "vm.h"
 #include "trap.h"
 #include "riscv.h"
@@ -16,6 +17,9 @@
 #include "stat.h"
 #include "fs_debug.h"
 #include "klog.h"
+#include "spinlock.h"
+#include "mcslock.h"
+#include "rwlock.h"
 
 
 // -------- 通用断言宏 --------
@@ -76,11 +80,191 @@ test_physical_memory_basic(void)
     printf("[exp3] physical allocator basic test OK.\n");
 }
 
+// 大量分配/释放会触发本地页缓存的 refill/drain，空闲页总数必须守恒
+static void
+test_physical_memory_batch(void)
+{
+    printf("\n[exp3] testing per-CPU page cache refill/drain...\n");
+
+    enum { NBATCH = 200 };
+    static void *pages[NBATCH];
+
+    uint64 before = pmm_free_pages();
+
+    for (int i = 0; i < NBATCH; i++) {
+        pages[i] = alloc_page();
+        KASSERT(pages[i] != 0);
+        KASSERT(((uint64)pages[i] & (PGSIZE - 1)) == 0);
+        *(uint64 *)pages[i] = i;   // 确认页面可写、互不重叠
+    }
+    KASSERT(pmm_free_pages() == before - NBATCH);
+
+    for (int i = 0; i < NBATCH; i++) {
+        KASSERT(*(uint64 *)pages[i] == (uint64)i);
+        free_page(pages[i]);
+    }
+    KASSERT(pmm_free_pages() == before);
+
+    printf("[exp3] per-CPU page cache test OK (free=%d).\n", (int)before);
+}
+
+// 伙伴系统：多页分配要按块大小对齐、互不重叠，释放后能合并回原状
+static void
+test_buddy_allocator(void)
+{
+    printf("\n[exp3] testing buddy allocator...\n");
+
+    uint64 before = pmm_free_pages();
+    uint64 top_before = pmm_free_blocks(MAX_ORDER - 1);
+
+    void *a = alloc_pages(0);
+    void *b = alloc_pages(3);
+    void *c = alloc_pages(9);    // 2MB，可用于超级页
+    KASSERT(a != 0 && b != 0 && c != 0);
+    KASSERT(((uint64)b % (PGSIZE << 3)) == 0);
+    KASSERT(((uint64)c % (PGSIZE << 9)) == 0);
+    KASSERT((uint64)b + (PGSIZE << 3) <= (uint64)c ||
+            (uint64)c + (PGSIZE << 9) <= (uint64)b);
+    KASSERT(pmm_free_pages() == before - (1 + 8 + 512));
+
+    printf("[exp3] alloc_pages: order0=%p order3=%p order9=%p\n",
+           (uint64)a, (uint64)b, (uint64)c);
+
+    free_pages(c, 9);
+    free_pages(b, 3);
+    free_pages(a, 0);
+
+    // 全部释放后应完全合并，最高阶空闲块数恢复
+    KASSERT(pmm_free_pages() == before);
+    KASSERT(pmm_free_blocks(MAX_ORDER - 1) == top_before);
+
+    printf("[exp3] buddy allocator test OK.\n");
+}
+
+// slab：带构造函数的对象 cache、per-CPU 弹匣，以及 kmalloc 各尺寸档和大块路径
+static int slab_ctor_calls;
+
+static void
+slab_test_ctor(void *obj)
+{
+    *(uint64 *)obj = 0x5ab;
+    slab_ctor_calls++;
+}
+
+static void
+test_slab_allocator(void)
+{
+    printf("\n[exp3] testing slab allocator...\n");
+
+    uint64 before = pmm_free_pages();
+
+    slab_ctor_calls = 0;
+    struct kmem_cache *c = kmem_cache_create("test-obj", 40, 8, slab_test_ctor);
+    KASSERT(c != 0);
+
+    #define NSLABOBJ 64
+    void *objs[NSLABOBJ];
+    for (int i = 0; i < NSLABOBJ; i++) {
+        objs[i] = kmem_cache_alloc(c);
+        KASSERT(objs[i] != 0);
+        KASSERT(((uint64)objs[i] & 7) == 0);
+        KASSERT(*(uint64 *)objs[i] == 0x5ab);   // 已构造
+        for (int j = 0; j < i; j++) {
+            KASSERT(objs[i] != objs[j]);
+        }
+    }
+    KASSERT(slab_ctor_calls >= NSLABOBJ);
+
+    for (int i = 0; i < NSLABOBJ; i++) {
+        kmem_cache_free(c, objs[i]);
+    }
+    // 刚释放的对象留在本 CPU 弹匣里，马上再分配应直接命中
+    void *again = kmem_cache_alloc(c);
+    KASSERT(again == objs[NSLABOBJ - 1]);
+    kmem_cache_free(c, again);
+
+    kmem_cache_shrink(c);
+    KASSERT(c->nactive == 0 && c->nslabs == 0);
+    #undef NSLABOBJ
+
+    // kmalloc：各尺寸档 + 大于 KMALLOC_MAX 的整页路径
+    uint64 sizes[] = { 1, 16, 17, 100, 512, 2048, 3000, 20000 };
+    void *p[8];
+    for (int i = 0; i < 8; i++) {
+        p[i] = kmalloc(sizes[i]);
+        KASSERT(p[i] != 0);
+        for (uint64 k = 0; k < sizes[i]; k++) {
+            ((char *)p[i])[k] = (char)i;
+        }
+    }
+    KASSERT(((uint64)p[7] % PGSIZE) == 0);
+    for (int i = 0; i < 8; i++) {
+        // 相邻的分配互不覆盖
+        KASSERT(((char *)p[i])[0] == (char)i && ((char *)p[i])[sizes[i] - 1] == (char)i);
+        kfree(p[i]);
+    }
+
+    debug_slab_state();
+
+    // 弹匣和每个 cache 保留的空 slab 可能还占着几页，但不应持续增长
+    printf("[exp3] slab allocator test OK (pages held by caches=%d).\n",
+           (int)(before - pmm_free_pages()));
+}
+
+// 内存统计：按标签记账，释放后计数归位，峰值不回落
+static void
+test_memory_accounting(void)
+{
+    printf("\n[exp3] testing memory accounting...\n");
+
+    struct mem_stats s0, s1, s2;
+    pmm_get_stats(&s0);
+
+    void *pt  = alloc_page_tag(MT_PGTABLE);
+    void *blk = alloc_pages_tag(2, MT_KSTACK);
+    KASSERT(pt != 0 && blk != 0);
+
+    pmm_get_stats(&s1);
+    KASSERT(s1.tag_pages[MT_PGTABLE] == s0.tag_pages[MT_PGTABLE] + 1);
+    KASSERT(s1.tag_pages[MT_KSTACK] == s0.tag_pages[MT_KSTACK] + 4);
+    KASSERT(s1.tag_allocs[MT_KSTACK] == s0.tag_allocs[MT_KSTACK] + 1);
+    KASSERT(s1.free_pages == s0.free_pages - 5);
+    KASSERT(s1.peak_pages >= s1.used_pages);
+
+    free_page(pt);
+    free_pages(blk, 2);
+
+    pmm_get_stats(&s2);
+    KASSERT(s2.tag_pages[MT_PGTABLE] == s0.tag_pages[MT_PGTABLE]);
+    KASSERT(s2.tag_pages[MT_KSTACK] == s0.tag_pages[MT_KSTACK]);
+    KASSERT(s2.free_pages == s0.free_pages);
+    KASSERT(s2.peak_pages >= s1.peak_pages);
+
+    debug_memory_state();
+    printf("[exp3] memory accounting test OK.\n");
+}
+
 static void
 test_virtual_memory_basic(void)
 {
     printf("\n[exp3] building kernel page table and enabling paging...\n");
     kvminit();
+
+    // 内核物理内存用大页恒等映射：KERNBASE 至少是 2MB 粒度，设备页仍是 4KB
+    KASSERT(vm_mapping_size(kernel_pagetable, KERNBASE) >= (2UL << 20));
+    if ((phys_top % (2UL << 20)) == 0)
+        KASSERT(vm_mapping_size(kernel_pagetable, phys_top - PGSIZE) >= (2UL << 20));
+    KASSERT(vm_mapping_size(kernel_pagetable, UART0) == PGSIZE);
+
+    // W^X：代码 R|X 不可写，只读数据不可写不可执行，数据/空闲内存可写不可执行
+    uint64 ftext = vm_mapping_flags(kernel_pagetable, (uint64)test_virtual_memory_basic);
+    uint64 frodata = vm_mapping_flags(kernel_pagetable, (uint64)"rodata");
+    uint64 fdata = vm_mapping_flags(kernel_pagetable, (uint64)&kernel_pagetable);
+    KASSERT((ftext & (PTE_R | PTE_W | PTE_X)) == (PTE_R | PTE_X));
+    KASSERT((frodata & (PTE_R | PTE_W | PTE_X)) == PTE_R);
+    KASSERT((fdata & (PTE_R | PTE_W | PTE_X)) == (PTE_R | PTE_W));
+    KASSERT((ftext & PTE_G) && (fdata & PTE_G));
+
     kvminithart();
     printf("[exp3] paging is now enabled, still printing via UART.\n");
 }
@@ -93,6 +277,12 @@ test_experiment3(void)
     // 1. 初始化物理内存分配器
     pmm_init();
     test_physical_memory_basic();
+    test_physical_memory_batch();
+    test_buddy_allocator();
+
+    slab_init();
+    test_slab_allocator();
+    test_memory_accounting();
 
     // 2. 构建内核页表并开启分页
     test_virtual_memory_basic();
@@ -175,6 +365,67 @@ test_exception_handling(void)
     printf("[exp4] Exception tests completed.\n");
 }
 
+// 嵌套持锁时，内层 release 不能提前打开中断；
+// 最外层 release 恢复到第一次 acquire 之前的中断状态。
+static void
+test_spinlock_nesting(void)
+{
+    printf("[exp4] Testing nested spinlocks & interrupt state...\n");
+
+    static struct spinlock outer, inner;
+    initlock(&outer, "test_outer");
+    initlock(&inner, "test_inner");
+
+    int was_on = intr_get();
+
+    acquire(&outer);
+    KASSERT(holding(&outer));
+    KASSERT(!intr_get());
+
+    acquire(&inner);
+    KASSERT(holding(&inner));
+    release(&inner);
+    KASSERT(!holding(&inner));
+    KASSERT(!intr_get());   // 仍然持有 outer，中断必须保持关闭
+
+    release(&outer);
+    KASSERT(intr_get() == was_on);
+
+    KASSERT(outer.nacquire == 1 && inner.nacquire == 1);
+    KASSERT(outer.ncontended == 0);
+
+    printf("[exp4] nested spinlock test OK.\n");
+}
+
+// 读写锁：多个读者可同时持有，写者独占
+static void
+test_rwlock_basic(void)
+{
+    printf("[exp4] Testing reader-writer locks...\n");
+
+    static struct rwspinlock rw;
+    initrwlock(&rw, "test_rw");
+
+    int was_on = intr_get();
+
+    read_acquire(&rw);
+    read_acquire(&rw);
+    KASSERT(rw.cnt == 2);
+    KASSERT(!intr_get());
+    read_release(&rw);
+    read_release(&rw);
+    KASSERT(rw.cnt == 0);
+    KASSERT(intr_get() == was_on);
+
+    write_acquire(&rw);
+    KASSERT(rw.cnt == -1 && write_holding(&rw));
+    write_release(&rw);
+    KASSERT(rw.cnt == 0 && !write_holding(&rw));
+    KASSERT(rw.nwrite == 1 && rw.ncontended == 0);
+
+    printf("[exp4] reader-writer lock test OK.\n");
+}
+
 static void
 test_experiment4(void)
 {
@@ -191,6 +442,8 @@ test_experiment4(void)
     // 3. 按手册要求依次执行中断/性能
     test_timer_interrupt();
     test_interrupt_overhead();
+    test_spinlock_nesting();
+    test_rwlock_basic();
 
     printf("[exp4] interrupt & timer tests finished.\n");
 }
@@ -235,7 +488,7 @@ debug_proc_table(const char *tag)
 static void
 simple_task(void)
 {
-    int pid = current_proc ? current_proc->pid : -1;
+    int pid = myproc() ? myproc()->pid : -1;
     printf("[exp5] simple_task: pid=%d start\n", pid);
 
     for (int i = 0; i < 3; i++) {
@@ -305,7 +558,7 @@ test_process_creation(void)
 static void
 cpu_intensive_task(void)
 {
-    int pid = current_proc ? current_proc->pid : -1;
+    int pid = myproc() ? myproc()->pid : -1;
     printf("[exp5] cpu_task: pid=%d start\n", pid);
 
     volatile uint64 sum = 0;
@@ -395,7 +648,7 @@ shared_buffer_init(void)
 static void
 producer_task(void)
 {
-    int pid = current_proc ? current_proc->pid : -1;
+    int pid = myproc() ? myproc()->pid : -1;
     printf("[exp5] producer(pid=%d) start\n", pid);
 
     for (;;) {
@@ -424,7 +677,7 @@ producer_task(void)
 static void
 consumer_task(void)
 {
-    int pid = current_proc ? current_proc->pid : -1;
+    int pid = myproc() ? myproc()->pid : -1;
     printf("[exp5] consumer(pid=%d) start\n", pid);
 
     for (;;) {
@@ -489,6 +742,117 @@ test_synchronization(void)
     debug_proc_table("after scheduler (sync test)");
 }
 
+// -------- 5.4 per-CPU 就绪队列 & work stealing 测试 --------
+//
+// kproc_create 会把线程分散到最空闲的 CPU 队列上，
+// 当前只有 hart 0 在跑调度器，其它队列里的线程只能靠偷取被执行。
+static void
+test_work_stealing(void)
+{
+    printf("[exp5] Testing per-CPU runqueues & work stealing...\n");
+
+    proc_init();
+
+    for (int i = 0; i < NPROC; i++) {
+        if (kproc_create(simple_task, "steal") == 0) {
+            panic("[exp5] test_work_stealing: create failed");
+        }
+    }
+
+    debug_sched_state();
+    scheduler_run();
+    debug_sched_state();
+
+    uint64 steals = 0, stolen = 0;
+    for (int i = 0; i < NCPU; i++) {
+        steals += cpus[i].nsteal;
+        stolen += cpus[i].nstolen;
+        KASSERT(cpus[i].rq.count == 0);
+    }
+    KASSERT(steals == stolen);
+    KASSERT(NCPU == 1 || mycpu()->nsteal > 0);
+
+    printf("[exp5] work stealing test OK (steals=%d).\n", (int)steals);
+}
+
+// -------- 5.5 锁微基准：TAS 自旋锁 vs MCS 队列锁 --------
+//
+// N 个线程各自循环加锁/计数/解锁，定期 yield 让其它线程交错执行。
+// 单 hart 上测到的主要是无竞争路径的开销；多 hart 运行时同一份代码
+// 会真正产生竞争，这时 MCS 的本地自旋和 FIFO 交接才会体现出来。
+
+#define LOCKBENCH_ITERS 20000
+#define LOCKBENCH_YIELD 5000
+
+static struct spinlock bench_tas;
+static struct mcslock  bench_mcs;
+static int bench_use_mcs;
+static volatile uint64 bench_counter;
+
+static void
+lock_bench_task(void)
+{
+    for (int i = 1; i <= LOCKBENCH_ITERS; i++) {
+        if (bench_use_mcs) {
+            mcs_acquire(&bench_mcs);
+            bench_counter++;
+            mcs_release(&bench_mcs);
+        } else {
+            acquire(&bench_tas);
+            bench_counter++;
+            release(&bench_tas);
+        }
+        if (i % LOCKBENCH_YIELD == 0) {
+            yield();
+        }
+    }
+    kproc_exit();
+}
+
+static uint64
+run_lock_bench(int use_mcs, int nthreads)
+{
+    proc_init();
+    bench_use_mcs = use_mcs;
+    bench_counter = 0;
+
+    for (int i = 0; i < nthreads; i++) {
+        if (kproc_create(lock_bench_task, use_mcs ? "bench_mcs" : "bench_tas") == 0) {
+            panic("[exp5] run_lock_bench: create failed");
+        }
+    }
+
+    uint64 t0 = get_time();
+    scheduler_run();
+    uint64 t1 = get_time();
+
+    KASSERT(bench_counter == (uint64)nthreads * LOCKBENCH_ITERS);
+    return t1 - t0;
+}
+
+static void
+test_lock_benchmark(void)
+{
+    printf("[exp5] Lock microbenchmark: TAS spinlock vs MCS queue lock...\n");
+
+    initlock(&bench_tas, "bench_tas");
+    initmcslock(&bench_mcs, "bench_mcs");
+
+    for (int n = 1; n <= NPROC; n *= 2) {
+        uint64 tas = run_lock_bench(0, n);
+        uint64 mcs = run_lock_bench(1, n);
+        printf("[exp5] lockbench threads=%d ops=%d: TAS=%d cycles, MCS=%d cycles\n",
+               n, n * LOCKBENCH_ITERS, (int)tas, (int)mcs);
+    }
+
+    printf("[exp5] TAS: acquires=%d contended=%d spin_cycles=%d\n",
+           (int)bench_tas.nacquire, (int)bench_tas.ncontended,
+           (int)bench_tas.spin_cycles);
+    printf("[exp5] MCS: acquires=%d contended=%d spin_cycles=%d\n",
+           (int)bench_mcs.nacquire, (int)bench_mcs.ncontended,
+           (int)bench_mcs.spin_cycles);
+}
+
 static void
 test_experiment5(void)
 {
@@ -498,6 +862,8 @@ test_experiment5(void)
     test_process_creation();
     test_scheduler();
     test_synchronization();
+    test_work_stealing();
+    test_lock_benchmark();
 
     printf("[exp5] all Experiment 5 tests finished.\n");
 }
@@ -532,17 +898,16 @@ kmemcmp(const void *a, const void *b, int n)
 // -------- 实验6：系统调用框架测试 --------
 //
 // 在内核中“伪造”一个 syscall 调用环境：
-//   - 构造一个假的 current_proc，用来测试 SYS_getpid
+//   - 构造一个假的当前进程（本 CPU 的 proc），用来测试 SYS_getpid
 //   - 构造 syscall_frame，设置 a0~a7，然后调用 syscall()
 //   - 测试：getpid / uptime / pause / test_add / test_str
 
 
 // -------- Experiment 6: syscall 测试辅助 --------
 
-extern struct proc *current_proc;
 extern volatile uint64 ticks;   // 在 trap.c 中定义，用于时间/性能测试
 
-// 用一个假的 proc 作为 current_proc，方便 sys_getpid 使用
+// 用一个假的 proc 作为本 CPU 上正在运行的线程，方便 sys_getpid 使用
 static struct proc fake_proc;
 
 static void
@@ -556,7 +921,7 @@ set_fake_current_proc(int pid)
     for (int i = 0; i < (int)sizeof(fake_proc.name); i++) {
         fake_proc.name[i] = 0;
     }
-    current_proc = &fake_proc;
+    mycpu()->proc = &fake_proc;
 }
 
 // 封装一次 syscall 调用，方便下面的测试代码
@@ -690,6 +1055,108 @@ test_syscall_performance(void)
            (int)start_ticks, (int)end_ticks);
 }
 
+// ==================== 5) 用户态进程 ====================
+// initcode.S 里内嵌的两段用户程序：
+// initcode 通过 ecall 调 test_str/getpid/exit，exit 码是 pid + 100；
+// faultcode 往自己的只读代码页里写，应当被内核杀掉（exit 码 -1）。
+extern char initcode_start[], initcode_end[];
+extern char faultcode_start[], faultcode_end[];
+extern char forkcode_start[], forkcode_end[];
+extern char lazycode_start[], lazycode_end[];
+extern char mmapcode_start[], mmapcode_end[];
+
+static void
+test_user_mode(void)
+{
+    printf("[exp6] Testing user-mode processes...\n");
+
+    proc_init();
+    mycpu()->proc = 0;
+
+    struct mem_stats before, after;
+    pmm_get_stats(&before);
+
+    struct proc *init = uproc_create(initcode_start, initcode_end - initcode_start, "initcode");
+    struct proc *bad  = uproc_create(faultcode_start, faultcode_end - faultcode_start, "faultcode");
+    KASSERT(init != 0 && bad != 0);
+    int init_pid = init->pid;
+
+    scheduler_run();
+
+    KASSERT(init->state == PROC_ZOMBIE && init->xstate == init_pid + 100);
+    KASSERT(bad->state == PROC_ZOMBIE && bad->xstate == -1);
+    KASSERT(init->pagetable == 0 && bad->pagetable == 0);
+
+    // 用户页、页表页和 trapframe 都还回去了
+    pmm_get_stats(&after);
+    KASSERT(after.tag_pages[MT_USER] == before.tag_pages[MT_USER]);
+    KASSERT(after.tag_pages[MT_PGTABLE] == before.tag_pages[MT_PGTABLE]);
+
+    printf("[exp6] user mode OK: initcode exit=%d, faultcode exit=%d, asid_max=%d\n",
+           init->xstate, bad->xstate, (int)asid_max);
+}
+
+// 写时复制 fork：父子进程写同一个栈变量，互不影响；结束后共享页全部释放
+static void
+test_cow_fork(void)
+{
+    printf("[exp6] Testing copy-on-write fork...\n");
+
+    proc_init();
+    mycpu()->proc = 0;
+
+    struct mem_stats before, after;
+    pmm_get_stats(&before);
+
+    struct proc *parent = uproc_create(forkcode_start, forkcode_end - forkcode_start, "forkcode");
+    KASSERT(parent != 0);
+
+    scheduler_run();
+
+    struct proc *child = 0;
+    for (int i = 0; i < NPROC; i++) {
+        if (procs[i].state != PROC_UNUSED && &procs[i] != parent) {
+            child = &procs[i];
+        }
+    }
+    KASSERT(child != 0);
+    KASSERT(parent->state == PROC_ZOMBIE && parent->xstate == 9);
+    KASSERT(child->state == PROC_ZOMBIE && child->xstate == 8);
+
+    pmm_get_stats(&after);
+    KASSERT(after.tag_pages[MT_USER] == before.tag_pages[MT_USER]);
+
+    printf("[exp6] cow fork OK: parent exit=%d, child exit=%d\n",
+           parent->xstate, child->xstate);
+}
+
+// 按需分配：sbrk 16MB 只碰两页，实际分配的用户页应该只有个位数
+static void
+test_lazy_allocation(void)
+{
+    printf("[exp6] Testing lazy heap/stack allocation...\n");
+
+    proc_init();
+    mycpu()->proc = 0;
+
+    struct mem_stats before, after;
+    pmm_get_stats(&before);
+
+    struct proc *p = uproc_create(lazycode_start, lazycode_end - lazycode_start, "lazycode");
+    KASSERT(p != 0);
+
+    scheduler_run();
+
+    KASSERT(p->state == PROC_ZOMBIE && p->xstate == 11);
+
+    pmm_get_stats(&after);
+    uint64 nalloc = after.tag_allocs[MT_USER] - before.tag_allocs[MT_USER];
+    KASSERT(nalloc < 16);   // trapframe + 代码 + 栈 + 碰过的 3 个堆页，而不是 4096 页
+    KASSERT(after.tag_pages[MT_USER] == before.tag_pages[MT_USER]);
+
+    printf("[exp6] lazy allocation OK: sbrk(16MB) used %d user pages\n", (int)nalloc);
+}
+
 // ======= 实验六总入口：在 run_all_tests() 里调用它 =======
 static void
 test_experiment6(void)
@@ -700,6 +1167,9 @@ test_experiment6(void)
     test_parameter_passing();
     test_security();
     test_syscall_performance();
+    test_user_mode();
+    test_cow_fork();
+    test_lazy_allocation();
 
     printf("[exp6] all syscall sub-tests finished.\n");
 }
@@ -775,6 +1245,70 @@ fs_sys_dup(int fd)
     return (int)f.a0;
 }
 
+static int
+fs_sys_fsync(int fd)
+{
+    struct syscall_frame f;
+    do_syscall(&f, SYS_fsync, (uint64)fd, 0, 0);
+    return (int)f.a0;
+}
+
+static int
+fs_sys_fdatasync(int fd)
+{
+    struct syscall_frame f;
+    do_syscall(&f, SYS_fdatasync, (uint64)fd, 0, 0);
+    return (int)f.a0;
+}
+
+static int
+fs_sys_sync(void)
+{
+    struct syscall_frame f;
+    do_syscall(&f, SYS_sync, 0, 0, 0);
+    return (int)f.a0;
+}
+
+static int
+fs_sys_readv(int fd, struct iovec *iov, int cnt)
+{
+    struct syscall_frame f;
+    do_syscall(&f, SYS_readv, (uint64)fd, (uint64)iov, (uint64)cnt);
+    return (int)f.a0;
+}
+
+static int
+fs_sys_writev(int fd, struct iovec *iov, int cnt)
+{
+    struct syscall_frame f;
+    do_syscall(&f, SYS_writev, (uint64)fd, (uint64)iov, (uint64)cnt);
+    return (int)f.a0;
+}
+
+// 参数多于三个的调用，do_syscall 只填三个
+static int
+fs_sys5(int num, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4)
+{
+    struct syscall_frame f;
+    f.a0 = a0;
+    f.a1 = a1;
+    f.a2 = a2;
+    f.a3 = a3;
+    f.a4 = a4;
+    f.a5 = 0;
+    f.a6 = 0;
+    f.a7 = num;
+    syscall(&f);
+    return (int)f.a0;
+}
+
+// pread/pwrite
+static int
+fs_sys_pio(int num, int fd, void *buf, int n, uint32 off)
+{
+    return fs_sys5(num, (uint64)fd, (uint64)buf, (uint64)n, off, 0);
+}
+
 // ==================== 1) 基本读写完整性测试 ====================
 // 创建一个文件 -> 写入一段字符串 -> 重新打开读出 -> 比较内容 + fstat 检查 size
 
@@ -980,6 +1514,645 @@ test_fs_performance(void)
            (int)(t1 - t0), (int)(t2 - t1));
 }
 
+// ==================== 5) 缓存无锁查找测试 ====================
+// iget()/bread() 的命中走 RCU 快路径：同一个 inode/块应返回同一个对象，
+// 引用计数正确增减，命中次数增加。
+
+static void
+test_fs_cache_lookup(void)
+{
+    printf("[exp7] test_fs_cache_lookup: lock-free cache hits...\n");
+
+    fs_test_init_once();
+
+    struct inode *a = iget(ROOTDEV, ROOTINO);
+    struct inode *b = iget(ROOTDEV, ROOTINO);
+    KASSERT(a == b);
+    int ref = a->ref;
+    KASSERT(ref >= 2);
+    iput(b);
+    KASSERT(a->ref == ref - 1);
+    iput(a);
+
+    struct buf *bp = bread(ROOTDEV, 1);
+    brelse(bp);
+    uint64 hits = buffer_cache_hits;
+    bp = bread(ROOTDEV, 1);
+    KASSERT(bp->blockno == 1 && bp->refcnt == 1);
+    brelse(bp);
+    KASSERT(buffer_cache_hits == hits + 1);
+    KASSERT(bp->refcnt == 0);
+
+    printf("[exp7] test_fs_cache_lookup OK.\n");
+}
+
+// ==================== 6) 页缓存测试 ====================
+// 第二次读同一个文件应当全部命中页缓存，不再读盘；O_TRUNC 截断时缓存页被释放。
+
+static void
+test_fs_page_cache(void)
+{
+    printf("[exp7] test_fs_page_cache: reads served from the page cache...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(205);
+
+    const char *name = "fs_pcache.bin";
+    const int npages = 4;
+    char buf[BSIZE];
+
+    int fd = fs_sys_open(name, O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    for (int i = 0; i < npages; i++) {
+        for (int j = 0; j < BSIZE; j++) {
+            buf[j] = (char)(i + j);
+        }
+        KASSERT(fs_sys_write(fd, buf, BSIZE) == BSIZE);
+    }
+    KASSERT(fs_sys_close(fd) == 0);
+
+    struct mem_stats ms;
+    pmm_get_stats(&ms);
+    int64 cached = ms.tag_pages[MT_PAGECACHE];
+
+    uint64 hits = pcache_hits;
+    uint64 reads = disk_read_count;
+
+    fd = fs_sys_open(name, O_RDONLY);
+    KASSERT(fd >= 0);
+    for (int i = 0; i < npages; i++) {
+        KASSERT(fs_sys_read(fd, buf, BSIZE) == BSIZE);
+        KASSERT(buf[0] == (char)i && buf[BSIZE - 1] == (char)(i + BSIZE - 1));
+    }
+    KASSERT(fs_sys_close(fd) == 0);
+
+    KASSERT(pcache_hits - hits >= (uint64)npages);
+    KASSERT(disk_read_count == reads);
+
+    fd = fs_sys_open(name, O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_close(fd) == 0);
+    pmm_get_stats(&ms);
+    KASSERT(ms.tag_pages[MT_PAGECACHE] == cached - npages);
+
+    printf("[exp7] test_fs_page_cache OK (hits=%d).\n", (int)(pcache_hits - hits));
+}
+
+// ==================== 7) 延迟写回 + fsync ====================
+// write 返回时数据只在页缓存里：块还没分配、页是脏的。
+// fsync 之后块分配好、脏页清零、日志提交掉；丢掉缓存重新读，读到的是磁盘上的内容。
+
+static void
+test_fs_writeback(void)
+{
+    printf("[exp7] test_fs_writeback: delayed writeback and fsync...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(207);
+
+    const char *name = "fs_wb.bin";
+    const int npages = 3;
+    char buf[BSIZE];
+
+    int fd = fs_sys_open(name, O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    for (int i = 0; i < npages; i++) {
+        for (int j = 0; j < BSIZE; j++) {
+            buf[j] = (char)('a' + i);
+        }
+        KASSERT(fs_sys_write(fd, buf, BSIZE) == BSIZE);
+    }
+
+    begin_op();
+    struct inode *ip = namei((char *)name);
+    end_op();
+    KASSERT(ip != 0);
+
+    ilock(ip);
+    KASSERT(ip->size == (uint32)(npages * BSIZE));
+    KASSERT(ip->pc.nrdirty == (uint32)npages && ip->pc.pinned);
+    KASSERT(ibmap(ip, 0, 0) == 0);   // 块还没分配
+    iunlock(ip);
+
+    uint64 written = writeback_pages;
+    KASSERT(fs_sys_fsync(fd) == 0);
+    KASSERT(writeback_pages - written == (uint64)npages);
+    KASSERT(log.lh.n == 0);
+
+    ilock(ip);
+    KASSERT(ip->pc.nrdirty == 0 && !ip->pc.pinned && !ip->idirty);
+    KASSERT(ibmap(ip, npages - 1, 0) != 0);
+    pcache_truncate(ip, 0);   // 丢掉缓存，下面的读只能从磁盘来
+    iunlock(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+    KASSERT(fs_sys_close(fd) == 0);
+
+    fd = fs_sys_open(name, O_RDONLY);
+    KASSERT(fd >= 0);
+    for (int i = 0; i < npages; i++) {
+        KASSERT(fs_sys_read(fd, buf, BSIZE) == BSIZE);
+        KASSERT(buf[0] == (char)('a' + i) && buf[BSIZE - 1] == (char)('a' + i));
+    }
+    KASSERT(fs_sys_close(fd) == 0);
+
+    printf("[exp7] test_fs_writeback OK.\n");
+}
+
+// ==================== 8) fsync / fdatasync / sync ====================
+// 只改了和读数据无关的元数据时 fdatasync 不提交日志、fsync 提交；
+// 文件自己的改动早就提交过时两者都不碰别人攒着的事务；sync 全部写回并提交。
+
+static void
+test_fs_sync(void)
+{
+    printf("[exp7] test_fs_sync: fsync/fdatasync/sync commit semantics...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(208);
+
+    char buf[BSIZE];
+    for (int j = 0; j < BSIZE; j++) {
+        buf[j] = 's';
+    }
+
+    int fd = fs_sys_open("fs_sync.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_write(fd, buf, BSIZE) == BSIZE);
+    KASSERT(fs_sys_fdatasync(fd) == 0);
+    KASSERT(log.lh.n == 0);
+
+    begin_op();
+    struct inode *ip = namei("fs_sync.bin");
+    end_op();
+    KASSERT(ip != 0);
+
+    // 只动元数据（相当于 chmod/touch）：fdatasync 不用等，fsync 要等
+    begin_op();
+    ilock(ip);
+    iupdate(ip);
+    iunlock(ip);
+    end_op();
+    KASSERT(log.lh.n > 0);
+    KASSERT(fs_sys_fdatasync(fd) == 0);
+    KASSERT(log.lh.n > 0);
+    KASSERT(fs_sys_fsync(fd) == 0);
+    KASSERT(log.lh.n == 0);
+
+    // 别的文件攒着的事务不归这个文件的 fsync 管
+    int fd2 = fs_sys_open("fs_sync2.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd2 >= 0);
+    KASSERT(fs_sys_write(fd2, buf, BSIZE) == BSIZE);
+    KASSERT(log.lh.n > 0);
+    KASSERT(fs_sys_fsync(fd) == 0);
+    KASSERT(log.lh.n > 0);
+
+    KASSERT(fs_sys_sync() == 0);
+    KASSERT(log.lh.n == 0 && pcache_dirty == 0);
+
+    begin_op();
+    iput(ip);
+    end_op();
+    KASSERT(fs_sys_close(fd2) == 0);
+    KASSERT(fs_sys_close(fd) == 0);
+
+    printf("[exp7] test_fs_sync OK.\n");
+}
+
+// ==================== 9) readv/writev + pread/pwrite ====================
+// writev 把三段拼成一次写，readv 跨段读回；pread/pwrite 按给定偏移读写，
+// 文件偏移保持不动，之后的 write 仍然接在 writev 的末尾。
+
+static void
+test_fs_vectored(void)
+{
+    printf("[exp7] test_fs_vectored: readv/writev/pread/pwrite...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(209);
+
+    static char mid[BSIZE];
+    for (int i = 0; i < BSIZE; i++) {
+        mid[i] = (char)('0' + i % 10);
+    }
+
+    int fd = fs_sys_open("fs_vec.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+
+    struct iovec iov[3];
+    iov[0].iov_base = (uint64)"head";
+    iov[0].iov_len  = 4;
+    iov[1].iov_base = (uint64)mid;
+    iov[1].iov_len  = BSIZE;
+    iov[2].iov_base = (uint64)"tail";
+    iov[2].iov_len  = 4;
+    KASSERT(fs_sys_writev(fd, iov, 3) == BSIZE + 8);
+
+    // 覆盖第二段开头两个字节，文件偏移不动
+    KASSERT(fs_sys_pio(SYS_pwrite, fd, "XY", 2, 4) == 2);
+    KASSERT(fs_sys_write(fd, "!", 1) == 1);
+
+    char a[6], b[4];
+    KASSERT(fs_sys_pio(SYS_pread, fd, a, 6, 0) == 6);
+    KASSERT(a[0] == 'h' && a[3] == 'd' && a[4] == 'X' && a[5] == 'Y');
+    KASSERT(fs_sys_pio(SYS_pread, fd, b, 4, BSIZE + 5) == 4);
+    KASSERT(b[0] == 'a' && b[2] == 'l' && b[3] == '!');
+    KASSERT(fs_sys_pio(SYS_pread, fd, b, 4, BSIZE + 9) == 0);   // 文件末尾
+    KASSERT(fs_sys_close(fd) == 0);
+
+    // readv：第一段 6 字节，第二段跨到文件末尾，读不满就停
+    static char rest[BSIZE + 8];
+    fd = fs_sys_open("fs_vec.bin", O_RDONLY);
+    KASSERT(fd >= 0);
+    iov[0].iov_base = (uint64)a;
+    iov[0].iov_len  = 6;
+    iov[1].iov_base = (uint64)rest;
+    iov[1].iov_len  = sizeof(rest);
+    KASSERT(fs_sys_readv(fd, iov, 2) == BSIZE + 9);
+    KASSERT(a[4] == 'X' && rest[0] == (char)('0' + 2) && rest[BSIZE + 2] == '!');
+    KASSERT(fs_sys_read(fd, b, 1) == 0);
+    KASSERT(fs_sys_readv(fd, iov, IOV_MAX + 1) == -1);
+    KASSERT(fs_sys_close(fd) == 0);
+
+    printf("[exp7] test_fs_vectored OK.\n");
+}
+
+// ==================== 10) 大写入的提交次数 ====================
+// 日志容量按超级块算；一次写 64 页，fsync 写回时每个事务装满日志能装的页，
+// 提交次数约为 64 / (容量 - 开销)，而不是每 MAXOPBLOCKS 块一次。
+
+static void
+test_fs_big_write(void)
+{
+    printf("[exp7] test_fs_big_write: large writes span few commits...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(210);
+
+    enum { NPAGES = 64 };
+    static char big[NPAGES * BSIZE];
+    for (int i = 0; i < NPAGES; i++) {
+        big[i * BSIZE] = (char)i;
+        big[i * BSIZE + BSIZE - 1] = (char)~i;
+    }
+
+    KASSERT(log.size == (int)sb.nlog);
+    KASSERT(log_op_max() == (int)sb.nlog - 1 && log_op_max() > MAXOPBLOCKS);
+
+    int fd = fs_sys_open("fs_big.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_write(fd, big, sizeof(big)) == (int)sizeof(big));
+
+    uint64 commits = log_commits;
+    KASSERT(fs_sys_fsync(fd) == 0);
+    int per = log_op_max() - WB_OP_OVERHEAD;
+    uint64 n = log_commits - commits;
+    KASSERT(n >= 1 && n <= (uint64)((NPAGES + per - 1) / per + 1));
+
+    char b[1];
+    KASSERT(fs_sys_pio(SYS_pread, fd, b, 1, (NPAGES - 1) * BSIZE) == 1 && b[0] == (char)(NPAGES - 1));
+    KASSERT(fs_sys_close(fd) == 0);
+
+    printf("[exp7] test_fs_big_write OK (%d commits for %d pages).\n", (int)n, NPAGES);
+}
+
+// ==================== 11) copy_file_range / sendfile ====================
+// 源文件两页半；copy_file_range 用文件自己的偏移整份拷贝，sendfile 从给定偏移拷一段，
+// 检查内容、两边偏移的推进，以及同一文件内重叠范围被拒绝。
+
+static void
+test_fs_copy_range(void)
+{
+    printf("[exp7] test_fs_copy_range: in-kernel file copies...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(211);
+
+    const int size = 2 * BSIZE + BSIZE / 2;
+    static char buf[2 * BSIZE + BSIZE / 2];
+    for (int i = 0; i < size; i++) {
+        buf[i] = (char)(i * 7 + 3);
+    }
+
+    int src = fs_sys_open("fs_cp_src.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(src >= 0);
+    KASSERT(fs_sys_write(src, buf, size) == size);
+
+    // 整份拷贝：fd_in 的偏移已经在末尾，显式给 0
+    int dst = fs_sys_open("fs_cp_dst.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(dst >= 0);
+    uint64 off_in = 0;
+    KASSERT(fs_sys5(SYS_copy_file_range, src, (uint64)&off_in, dst, 0, size + 100) == size);
+    KASSERT(off_in == (uint64)size);
+    KASSERT(fs_sys_pio(SYS_pread, dst, buf, size, 0) == size);
+    for (int i = 0; i < size; i++) {
+        KASSERT(buf[i] == (char)(i * 7 + 3));
+    }
+
+    // sendfile：从偏移 100 拷 5000 字节，接在 dst 末尾（dst 的偏移在 size）
+    uint64 off = 100;
+    KASSERT(fs_sys5(SYS_sendfile, dst, src, (uint64)&off, 5000, 0) == 5000);
+    KASSERT(off == 5100);
+    char b[2];
+    KASSERT(fs_sys_pio(SYS_pread, dst, b, 2, size) == 2);
+    KASSERT(b[0] == (char)(100 * 7 + 3) && b[1] == (char)(101 * 7 + 3));
+    KASSERT(fs_sys_pio(SYS_pread, dst, b, 1, size + 4999) == 1 && b[0] == (char)(5099 * 7 + 3));
+
+    // 同一文件里重叠的范围
+    off_in = 0;
+    uint64 off_out = 10;
+    KASSERT(fs_sys5(SYS_copy_file_range, src, (uint64)&off_in, src, (uint64)&off_out, 100) == -1);
+
+    KASSERT(fs_sys_close(dst) == 0);
+    KASSERT(fs_sys_close(src) == 0);
+
+    printf("[exp7] test_fs_copy_range OK.\n");
+}
+
+// ==================== 12) reflink 克隆 ====================
+// 源文件 NDIRECT+2 页（用到间接块），克隆后两边的块号相同、共享计数为 1；
+// 往克隆里写一个字节并 fsync，那一块换成新块，源文件的块计数回到 0、内容不变。
+// 最后 fsck_lite 按共享计数核对每个块的引用次数。
+
+static void
+test_fs_reflink(void)
+{
+    printf("[exp7] test_fs_reflink: block-sharing clones...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(212);
+
+    enum { NPAGES = NDIRECT + 2 };
+    static char buf[BSIZE];
+    int src = fs_sys_open("fs_rl_src.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(src >= 0);
+    for (int i = 0; i < NPAGES; i++) {
+        for (int j = 0; j < BSIZE; j++) {
+            buf[j] = (char)('A' + i);
+        }
+        KASSERT(fs_sys_write(src, buf, BSIZE) == BSIZE);
+    }
+
+    int dst = fs_sys_open("fs_rl_dst.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(dst >= 0);
+    KASSERT(fs_sys_write(dst, "old", 3) == 3);
+    KASSERT(fs_sys5(SYS_reflink, src, dst, 0, 0, 0) == 0);
+    KASSERT(fs_sys5(SYS_reflink, src, src, 0, 0, 0) == -1);
+
+    begin_op();
+    struct inode *sip = namei("fs_rl_src.bin");
+    struct inode *dip = namei("fs_rl_dst.bin");
+    end_op();
+    KASSERT(sip != 0 && dip != 0);
+
+    ilock(sip);
+    ilock(dip);
+    uint32 first = ibmap(sip, 0, 0), last = ibmap(sip, NPAGES - 1, 0);
+    KASSERT(dip->size == (uint32)(NPAGES * BSIZE));
+    KASSERT(ibmap(dip, 0, 0) == first && ibmap(dip, NPAGES - 1, 0) == last);
+    KASSERT(dip->addrs[NDIRECT] != sip->addrs[NDIRECT]);   // 间接块各有一份
+    KASSERT(brefcount(ROOTDEV, first) == 1 && brefcount(ROOTDEV, last) == 1);
+    iunlock(dip);
+    iunlock(sip);
+
+    // 克隆读到的是源的内容
+    KASSERT(fs_sys_pio(SYS_pread, dst, buf, 1, (NPAGES - 1) * BSIZE) == 1);
+    KASSERT(buf[0] == (char)('A' + NPAGES - 1));
+
+    // 改克隆的最后一页：写回时写时复制
+    KASSERT(fs_sys_pio(SYS_pwrite, dst, "z", 1, (NPAGES - 1) * BSIZE + 7) == 1);
+    KASSERT(fs_sys_fsync(dst) == 0);
+    ilock(sip);
+    ilock(dip);
+    KASSERT(ibmap(dip, NPAGES - 1, 0) != last && ibmap(dip, 0, 0) == first);
+    KASSERT(brefcount(ROOTDEV, last) == 0 && brefcount(ROOTDEV, first) == 1);
+    pcache_truncate(sip, 0);   // 源的内容从磁盘重新读
+    iunlock(dip);
+    iunlock(sip);
+    KASSERT(fs_sys_pio(SYS_pread, src, buf, BSIZE, (NPAGES - 1) * BSIZE) == BSIZE);
+    for (int j = 0; j < BSIZE; j++) {
+        KASSERT(buf[j] == (char)('A' + NPAGES - 1));
+    }
+    KASSERT(fs_sys_pio(SYS_pread, dst, buf, 8, (NPAGES - 1) * BSIZE) == 8);
+    KASSERT(buf[6] == (char)('A' + NPAGES - 1) && buf[7] == 'z');
+
+    begin_op();
+    iput(sip);
+    iput(dip);
+    end_op();
+    KASSERT(fs_sys_close(dst) == 0);
+    KASSERT(fs_sys_close(src) == 0);
+    KASSERT(fsck_lite() == 0);
+
+    printf("[exp7] test_fs_reflink OK.\n");
+}
+
+// ==================== 13) 稀疏文件与打洞 ====================
+// 从偏移 5 页多一点开始写，前面 5 页是洞：读出 0、写回后也没有分配块。
+// 另一个文件写满 4 页后在 [1 页+100, 3 页+50) 打洞：第 2 页的块被释放，
+// 两头不满一页的部分清零，其余内容和文件大小不变。
+
+static void
+test_fs_sparse(void)
+{
+    printf("[exp7] test_fs_sparse: holes and hole punching...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(213);
+
+    static char buf[4 * BSIZE];
+    int fd = fs_sys_open("fs_sparse.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_pio(SYS_pwrite, fd, "end", 3, 5 * BSIZE + 10) == 3);
+    KASSERT(fs_sys_fsync(fd) == 0);
+
+    struct stat st;
+    KASSERT(fs_sys_fstat(fd, &st) == 0 && st.size == 5 * BSIZE + 13);
+    KASSERT(fs_sys_pio(SYS_pread, fd, buf, sizeof(buf), BSIZE) == (int)sizeof(buf));
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        KASSERT(buf[i] == 0);
+    }
+    KASSERT(fs_sys_pio(SYS_pread, fd, buf, 3, 5 * BSIZE + 10) == 3 && buf[0] == 'e');
+
+    begin_op();
+    struct inode *ip = namei("fs_sparse.bin");
+    end_op();
+    KASSERT(ip != 0);
+    ilock(ip);
+    for (int i = 0; i < 5; i++) {
+        KASSERT(ibmap(ip, i, 0) == 0);
+    }
+    KASSERT(ibmap(ip, 5, 0) != 0);
+    iunlock(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+    KASSERT(fs_sys_close(fd) == 0);
+
+    // 打洞
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        buf[i] = 'p';
+    }
+    fd = fs_sys_open("fs_punch.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_write(fd, buf, sizeof(buf)) == (int)sizeof(buf));
+    KASSERT(fs_sys_fsync(fd) == 0);
+
+    int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+    KASSERT(fs_sys5(SYS_fallocate, fd, FALLOC_FL_PUNCH_HOLE, BSIZE, BSIZE, 0) == -1);
+    KASSERT(fs_sys5(SYS_fallocate, fd, mode, BSIZE + 100, 2 * BSIZE - 50, 0) == 0);
+    KASSERT(fs_sys_fsync(fd) == 0);
+
+    begin_op();
+    ip = namei("fs_punch.bin");
+    end_op();
+    KASSERT(ip != 0);
+    ilock(ip);
+    KASSERT(ibmap(ip, 1, 0) != 0 && ibmap(ip, 2, 0) == 0 && ibmap(ip, 3, 0) != 0);
+    pcache_truncate(ip, 0);   // 下面从磁盘读
+    iunlock(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+
+    KASSERT(fs_sys_fstat(fd, &st) == 0 && st.size == sizeof(buf));
+    KASSERT(fs_sys_pio(SYS_pread, fd, buf, sizeof(buf), 0) == (int)sizeof(buf));
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        int hole = i >= BSIZE + 100 && i < 3 * BSIZE + 50;
+        KASSERT(buf[i] == (hole ? 0 : 'p'));
+    }
+    KASSERT(fs_sys_close(fd) == 0);
+    KASSERT(fsck_lite() == 0);
+
+    printf("[exp7] test_fs_sparse OK.\n");
+}
+
+// ==================== 14) fallocate 预分配 ====================
+// 预分配 8 页：文件长到 8 页，块是连续的、带未写入标记，读出来是 0；
+// 再把 8 页写满并 fsync，块号不变、标记去掉、没有再分配新块。
+// KEEP_SIZE 在末尾之外再预分配一页，文件大小不变。
+
+static void
+test_fs_prealloc(void)
+{
+    printf("[exp7] test_fs_prealloc: fallocate reserves blocks up front...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(214);
+
+    enum { NPAGES = 8 };
+    static char buf[NPAGES * BSIZE];
+    int fd = fs_sys_open("fs_prealloc.bin", O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys5(SYS_fallocate, fd, 0, 0, sizeof(buf), 0) == 0);
+    KASSERT(fs_sys5(SYS_fallocate, fd, 0x10, 0, BSIZE, 0) == -1);
+
+    struct stat st;
+    KASSERT(fs_sys_fstat(fd, &st) == 0 && st.size == sizeof(buf));
+    KASSERT(fs_sys_pio(SYS_pread, fd, buf, sizeof(buf), 0) == (int)sizeof(buf));
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        KASSERT(buf[i] == 0);
+    }
+
+    begin_op();
+    struct inode *ip = namei("fs_prealloc.bin");
+    end_op();
+    KASSERT(ip != 0);
+
+    uint32 addrs[NPAGES];
+    ilock(ip);
+    for (int i = 0; i < NPAGES; i++) {
+        addrs[i] = ibmap(ip, i, 0);
+        KASSERT(addrs[i] & BUNWRITTEN);
+        KASSERT(BADDR(addrs[i]) == BADDR(addrs[0]) + i);
+    }
+    iunlock(ip);
+
+    // 追加写满：写回时只写数据块
+    for (int i = 0; i < (int)sizeof(buf); i++) {
+        buf[i] = (char)('a' + i / BSIZE);
+    }
+    KASSERT(fs_sys_write(fd, buf, sizeof(buf)) == (int)sizeof(buf));
+    KASSERT(fs_sys_fsync(fd) == 0);
+
+    ilock(ip);
+    for (int i = 0; i < NPAGES; i++) {
+        KASSERT(ibmap(ip, i, 0) == BADDR(addrs[i]));
+    }
+    iunlock(ip);
+
+    KASSERT(fs_sys5(SYS_fallocate, fd, FALLOC_FL_KEEP_SIZE, sizeof(buf), BSIZE, 0) == 0);
+    KASSERT(fs_sys_fstat(fd, &st) == 0 && st.size == sizeof(buf));
+    ilock(ip);
+    KASSERT(ibmap(ip, NPAGES, 0) & BUNWRITTEN);
+    pcache_truncate(ip, 0);   // 下面从磁盘读
+    iunlock(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+
+    char b[2];
+    KASSERT(fs_sys_pio(SYS_pread, fd, b, 2, 3 * BSIZE - 1) == 2);
+    KASSERT(b[0] == 'c' && b[1] == 'd');
+    KASSERT(fs_sys_close(fd) == 0);
+    KASSERT(fsck_lite() == 0);
+
+    printf("[exp7] test_fs_prealloc OK.\n");
+}
+
+// ==================== 15) mmap 文件映射测试 ====================
+// 内核先写好两页全是 'M' 的文件，用户程序 mmapcode 共享映射后改第二页首字节并 msync，
+// 再私有映射改第一页首字节，然后打洞打掉第二页，经共享映射读到 0 后写入 'H'。
+// 回到内核检查：共享写入落到了文件里（打洞之后的也在），私有写入没有，
+// 私有拷贝等用户页全部还回。
+
+static void
+test_fs_mmap(void)
+{
+    printf("[exp7] test_fs_mmap: shared/private file mappings...\n");
+
+    fs_test_init_once();
+    set_fake_current_proc(206);
+
+    const char *name = "mmapfile";
+    char buf[BSIZE];
+    int fd = fs_sys_open(name, O_CREATE | O_RDWR | O_TRUNC);
+    KASSERT(fd >= 0);
+    for (int i = 0; i < BSIZE; i++) {
+        buf[i] = 'M';
+    }
+    KASSERT(fs_sys_write(fd, buf, BSIZE) == BSIZE);
+    KASSERT(fs_sys_write(fd, buf, BSIZE) == BSIZE);
+    KASSERT(fs_sys_close(fd) == 0);
+
+    proc_init();
+    mycpu()->proc = 0;
+
+    struct mem_stats before, after;
+    pmm_get_stats(&before);
+
+    struct proc *p = uproc_create(mmapcode_start, mmapcode_end - mmapcode_start, "mmapcode");
+    KASSERT(p != 0);
+
+    scheduler_run();
+
+    KASSERT(p->state == PROC_ZOMBIE && p->xstate == 12);
+    pmm_get_stats(&after);
+    KASSERT(after.tag_pages[MT_USER] == before.tag_pages[MT_USER]);
+
+    set_fake_current_proc(206);
+    fd = fs_sys_open(name, O_RDONLY);
+    KASSERT(fd >= 0);
+    KASSERT(fs_sys_read(fd, buf, BSIZE) == BSIZE);
+    KASSERT(buf[0] == 'M' && buf[BSIZE - 1] == 'M');
+    KASSERT(fs_sys_read(fd, buf, BSIZE) == BSIZE);
+    KASSERT(buf[0] == 'H' && buf[1] == 0);
+    KASSERT(fs_sys_close(fd) == 0);
+
+    printf("[exp7] test_fs_mmap OK.\n");
+}
+
 // ======= 实验七总入口 =======
 
 static void
@@ -991,6 +2164,17 @@ test_experiment7(void)
     test_fs_large_file();
     test_fs_dup();
     test_fs_performance();
+    test_fs_cache_lookup();
+    test_fs_page_cache();
+    test_fs_writeback();
+    test_fs_sync();
+    test_fs_vectored();
+    test_fs_big_write();
+    test_fs_copy_range();
+    test_fs_reflink();
+    test_fs_sparse();
+    test_fs_prealloc();
+    test_fs_mmap();
 
     printf("[exp7] all file system tests finished.\n");
 }
@@ -1002,7 +2186,11 @@ test_experiment8_fs_diagnostics(void)
 
     // 这里默认你已经跑过 exp7，fs_init 已完成，superblock 已就绪
     debug_filesystem_state();
+    debug_memory_state();
+    debug_slab_state();
     debug_inode_usage();
+    debug_lock_stats();
+    debug_mcslock_stats();
 
     int r = fsck_lite();
     if (r == 0) {
@@ -1,7 +1,13 @@
 #include "types.h"
 #include "printf.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "trap.h"
+#include "proc.h"
+#include "vm.h"
+#include "syscall.h"
+#include "fs.h"
+#include "pagecache.h"   // writeback_kick
 
 // S 模式全局时钟计数
 volatile uint64 ticks = 0;
@@ -9,6 +15,16 @@ volatile uint64 ticks = 0;
 // kernelvec.S 中的符号
 extern void kernelvec(void);
 
+// trampoline.S 中的符号
+extern char trampoline[], uservec[], userret[];
+
+// scause 取值
+#define SCAUSE_INTR        (1UL << 63)
+#define SCAUSE_S_TIMER     (SCAUSE_INTR | 5)
+#define SCAUSE_ECALL_U     8
+#define SCAUSE_LOAD_PF     13
+#define SCAUSE_STORE_PF    15
+
 void
 trapinit(void)
 {
@@ -55,10 +71,12 @@ kerneltrap(void)
     }
 
     // 仅处理 S 模式时钟中断：scause = 1<<63 | 5
-    if (scause == (0x8000000000000000ULL | 5)) {
+    if (scause == SCAUSE_S_TIMER) {
         clockintr();
     } else {
-        printf("kerneltrap: unexpected scause=0x%d sepc=0x%d stval=0x%d\n",
+        // 内核从不经用户页表访问用户内存（copyin/copyout 自己处理缺页），
+        // 所以内核态的缺页一定是 bug
+        printf("kerneltrap: unexpected scause=%p sepc=%p stval=%p\n",
                scause, sepc, r_stval());
         panic("kerneltrap");
     }
@@ -67,3 +85,83 @@ kerneltrap(void)
     w_sepc(sepc);
     w_sstatus(sstatus);
 }
+
+// 用户态陷入：trampoline.S 的 uservec 已经保存好用户寄存器、切到内核页表和内核栈
+void
+usertrap(void)
+{
+    if ((r_sstatus() & SSTATUS_SPP) != 0) {
+        panic("usertrap: not from user mode");
+    }
+
+    // 之后在内核里再发生的 trap 交给 kernelvec
+    w_stvec((uint64)kernelvec);
+
+    struct proc *p = myproc();
+    p->trapframe->epc = r_sepc();
+
+    uint64 scause = r_scause();
+    if (scause == SCAUSE_ECALL_U) {
+        // 返回到 ecall 的下一条指令
+        p->trapframe->epc += 4;
+
+        // sepc/scause 已经取走，可以开中断了
+        intr_on();
+
+        // a0~a7 在 trapframe 里连续存放，结果写回 trapframe->a0
+        syscall((struct syscall_frame *)&p->trapframe->a0);
+    } else if (scause == SCAUSE_S_TIMER) {
+        clockintr();
+        // 只写了一点就长时间不再写的进程：脏数据到期时靠时钟把写回线程叫起来
+        writeback_kick();
+        // 时间片到：让出 CPU
+        yield();
+    } else if ((scause == SCAUSE_LOAD_PF || scause == SCAUSE_STORE_PF) &&
+               proc_fault(p, r_stval(), scause == SCAUSE_STORE_PF) == 0) {
+        // 懒分配的页刚映射上，或写时复制换成了私有页：
+        // 刷掉这个地址的旧 TLB 项后重新执行这条指令
+        proc_tlb_flush(p, PGROUNDDOWN(r_stval()));
+    } else {
+        printf("usertrap: pid=%d (%s) unexpected scause=%p sepc=%p stval=%p\n",
+               p->pid, p->name, scause, r_sepc(), r_stval());
+        p->killed = 1;
+    }
+
+    if (p->killed) {
+        uproc_exit(-1);
+    }
+
+    usertrapret();
+}
+
+// 回到用户态：设置好 stvec/trapframe/sstatus/sepc，经 trampoline 的 userret 切换页表并 sret
+void
+usertrapret(void)
+{
+    struct proc *p = myproc();
+
+    // 从这里到 sret 之间不能再进 kernelvec：stvec 马上要改成 uservec
+    intr_off();
+
+    w_stvec(TRAMPOLINE + (uservec - trampoline));
+
+    // 下次陷入时 uservec 需要的内核信息
+    p->trapframe->kernel_satp   = r_satp();
+    p->trapframe->kernel_sp     = p->kstack + KSTACK_SIZE;
+    p->trapframe->kernel_trap   = (uint64)usertrap;
+    p->trapframe->kernel_hartid = r_tp();
+
+    // sret 回到用户态，并在用户态打开中断
+    uint64 x = r_sstatus();
+    x &= ~SSTATUS_SPP;
+    x |= SSTATUS_SPIE;
+    w_sstatus(x);
+
+    w_sepc(p->trapframe->epc);
+
+    uint64 satp = proc_satp(p);
+
+    // 跳到 trampoline 里的 userret（用 TRAMPOLINE 处的映射，切页表后地址不变）
+    void (*fn)(uint64) = (void (*)(uint64))(TRAMPOLINE + (userret - trampoline));
+    fn(satp);
+}
@@ -87,7 +87,7 @@ virtio_disk_init(void)
     sb.magic = FSMAGIC;
     sb.size  = FSSIZE;   // 总块数
 
-    sb.nlog      = LOGSIZE;  // 使用 fs.h 中定义的 LOGSIZE
+    sb.nlog      = LOGSIZE;  // 日志区大小记在超级块里，initlog 按它算容量
     sb.logstart  = 2;        // 约定：块 0 保留，块 1 superblock，块 2..logstart+nlog-1 为日志
 
     sb.ninodes   = 200;      // 可根据需要调整 inode 总数
@@ -99,7 +99,11 @@ virtio_disk_init(void)
     // 位图块数量（当前 FSSIZE 不大，一般只需要 1 块）
     uint32 nbitmapblocks = (sb.size + BPB - 1) / BPB;
 
-    uint32 data_start = sb.bmapstart + nbitmapblocks;  // 数据块起始编号
+    // 共享计数区紧跟位图，全 0（没有共享块）
+    sb.refstart = sb.bmapstart + nbitmapblocks;
+    uint32 nrefblocks = (sb.size + RPB - 1) / RPB;
+
+    uint32 data_start = sb.refstart + nrefblocks;      // 数据块起始编号
     sb.nblocks = sb.size - data_start;                 // 数据块数量
 
     // 把 superblock 写入 block 1
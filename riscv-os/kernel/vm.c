@@ -1,8 +1,10 @@
 #include "types.h"
 #include "memlayout.h"
 #include "printf.h"
+#include "riscv.h"
 #include "pmm.h"
 #include "vm.h"
+#include "proc.h"
 
 // -------- Sv39 相关宏 --------
 
@@ -10,36 +12,6 @@
 #define PXSHIFT(level) (12 + 9 * (level))
 #define PX(level, va)  ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
 
-// PTE 标志位
-#define PTE_V (1L << 0)  // 有效
-#define PTE_R (1L << 1)  // 可读
-#define PTE_W (1L << 2)  // 可写
-#define PTE_X (1L << 3)  // 可执行
-#define PTE_U (1L << 4)  // 用户态访问
-#define PTE_G (1L << 5)
-#define PTE_A (1L << 6)
-#define PTE_D (1L << 7)
-
-#define PTE_FLAGS(pte) ((pte) & 0x3FFUL)
-#define PTE_PA(pte)    (((pte) >> 10) << 12)
-#define PA2PTE(pa)     ((((uint64)(pa)) >> 12) << 10)
-
-static inline void
-w_satp(uint64 x)
-{
-    asm volatile("csrw satp, %0" : : "r"(x));
-}
-
-static inline void
-sfence_vma(void)
-{
-    asm volatile("sfence.vma zero, zero");
-}
-
-// MODE=8 表示 Sv39
-#define MAKE_SATP(pagetable) \
-    (((uint64)8 << 60) | ((((uint64)(pagetable)) >> 12) & ((1L << 44) - 1)))
-
 // 简单本地 memset，避免依赖 libc
 static void *
 memset_local(void *dst, int c, uint64 n)
@@ -54,23 +26,35 @@ memset_local(void *dst, int c, uint64 n)
 
 pagetable_t kernel_pagetable;
 
+// 硬件实现的最大 ASID（kvminithart 探测；0 表示不支持 ASID）
+uint64 asid_max;
+
 // -------- 基本页表操作 --------
 
-// 从 pagetable 中查找 va 对应的 PTE，alloc!=0 时需要则分配中间页表
+// 各级叶子映射的大小：level 0 = 4KB，1 = 2MB（megapage），2 = 1GB（gigapage）
+#define LEVELSIZE(level) (1UL << PXSHIFT(level))
+
+// 有效且 R/W/X 任一位置位的 PTE 是叶子；非叶子 PTE 指向下一级页表
+#define PTE_LEAF(pte)  (((pte) & PTE_V) && ((pte) & (PTE_R | PTE_W | PTE_X)))
+
+// 从 pagetable 中查找 va 在第 level 级的 PTE，alloc!=0 时需要则分配中间页表。
+// 中途遇到大页叶子时直接返回该叶子的 PTE（调用者可据此判断映射粒度）。
 static pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walk_level(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
     if (va >= MAXVA)
         panic("walk: va >= MAXVA");
 
-    for (int level = 2; level > 0; level--) {
-        pte_t *pte = &pagetable[PX(level, va)];
+    for (int l = 2; l > level; l--) {
+        pte_t *pte = &pagetable[PX(l, va)];
         if (*pte & PTE_V) {
+            if (PTE_LEAF(*pte))
+                return pte;
             pagetable = (pagetable_t)PTE_PA(*pte);
         } else {
             if (!alloc)
                 return 0;
-            pagetable_t newpage = (pagetable_t)alloc_page();
+            pagetable_t newpage = (pagetable_t)alloc_page_tag(MT_PGTABLE);
             if (newpage == 0)
                 return 0;
             memset_local(newpage, 0, PGSIZE);
@@ -79,7 +63,31 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
         }
     }
 
-    return &pagetable[PX(0, va)];
+    return &pagetable[PX(level, va)];
+}
+
+// 查找 va 对应的最底层 PTE（4KB 页，或覆盖 va 的大页叶子）
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+    return walk_level(pagetable, va, 0, alloc);
+}
+
+// 在第 level 级建立一个叶子映射：va -> pa，要求两者都按该级大小对齐
+static int
+mapleaf(pagetable_t pagetable, uint64 va, uint64 pa, int level, int perm)
+{
+    if ((va % LEVELSIZE(level)) != 0 || (pa % LEVELSIZE(level)) != 0)
+        panic("mapleaf: not aligned");
+
+    pte_t *pte = walk_level(pagetable, va, level, 1);
+    if (pte == 0)
+        return -1;
+    if (*pte & PTE_V)
+        panic("mappage: remap");
+
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    return 0;
 }
 
 // 映射单个页：va -> pa，要求两者都 4KB 对齐
@@ -99,22 +107,32 @@ mappage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
     return 0;
 }
 
+// 各级叶子的数量，kvminit 结束时打印
+static uint64 kvm_nleaf[3];
+
 // 映射一段区域：[va, va+sz) -> [pa, pa+sz)
+// 每一步都选 va、pa 同时对齐且剩余长度放得下的最大一级：
+// 能用 1GB 就用 1GB，其次 2MB，最后才退回 4KB。
 static void
 kvmmap(pagetable_t pagetable, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-    uint64 a    = PGROUNDDOWN(va);
-    uint64 last = PGROUNDDOWN(va + sz - 1);
-
     // 这里要求调用者保证 va/pa/size 都是页对齐的，
-    // 否则就会在 mappage 中 panic。
-    for (;;) {
-        if (mappage(pagetable, a, pa, perm) != 0)
-            panic("kvmmap: mappage failed");
-        if (a == last)
-            break;
-        a  += PGSIZE;
-        pa += PGSIZE;
+    // 否则就会在 mapleaf 中 panic。
+    uint64 a   = va;
+    uint64 end = va + sz;
+
+    while (a < end) {
+        int level = 2;
+        while (level > 0 &&
+               ((a % LEVELSIZE(level)) != 0 || (pa % LEVELSIZE(level)) != 0 ||
+                end - a < LEVELSIZE(level))) {
+            level--;
+        }
+        if (mapleaf(pagetable, a, pa, level, perm) != 0)
+            panic("kvmmap: mapleaf failed");
+        kvm_nleaf[level]++;
+        a  += LEVELSIZE(level);
+        pa += LEVELSIZE(level);
     }
 }
 
@@ -122,7 +140,7 @@ kvmmap(pagetable_t pagetable, uint64 va, uint64 pa, uint64 sz, int perm)
 pagetable_t
 create_pagetable(void)
 {
-    pagetable_t pt = (pagetable_t)alloc_page();
+    pagetable_t pt = (pagetable_t)alloc_page_tag(MT_PGTABLE);
     if (pt == 0)
         return 0;
     memset_local(pt, 0, PGSIZE);
@@ -136,8 +154,290 @@ map_page(pagetable_t pt, uint64 va, uint64 pa, int perm)
     return mappage(pt, va, pa, perm);
 }
 
-// 链接脚本里导出的符号：代码段结束
+// 对外接口：va 所在叶子映射的权限位（PTE 低 10 位），未映射返回 0
+uint64
+vm_mapping_flags(pagetable_t pt, uint64 va)
+{
+    for (int level = 2; level >= 0; level--) {
+        pte_t pte = pt[PX(level, va)];
+        if ((pte & PTE_V) == 0)
+            return 0;
+        if (PTE_LEAF(pte))
+            return PTE_FLAGS(pte);
+        pt = (pagetable_t)PTE_PA(pte);
+    }
+    return 0;
+}
+
+// 对外接口：va 所在叶子映射的大小（4KB/2MB/1GB），未映射返回 0
+uint64
+vm_mapping_size(pagetable_t pt, uint64 va)
+{
+    for (int level = 2; level >= 0; level--) {
+        pte_t pte = pt[PX(level, va)];
+        if ((pte & PTE_V) == 0)
+            return 0;
+        if (PTE_LEAF(pte))
+            return LEVELSIZE(level);
+        pt = (pagetable_t)PTE_PA(pte);
+    }
+    return 0;
+}
+
+// -------- 用户地址空间 --------
+
+// 用户页的 PTE：va 已映射且带 PTE_U 时返回，否则返回 0
+static pte_t *
+user_pte(pagetable_t pagetable, uint64 va)
+{
+    if (va >= MAXVA)
+        return 0;
+    pte_t *pte = walk(pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+        return 0;
+    return pte;
+}
+
+// 用户虚拟地址 va 所在页的物理地址，未映射或不是用户页返回 0
+uint64
+walkaddr(pagetable_t pagetable, uint64 va)
+{
+    pte_t *pte = user_pte(pagetable, va);
+    return pte ? PTE_PA(*pte) : 0;
+}
+
+// 拆掉从 va 开始的 npages 个页映射，do_free 时顺带释放物理页。
+// 没映射的页直接跳过（guard page、以后的按需分配都会留下空洞）。
+void
+uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+    if ((va % PGSIZE) != 0)
+        panic("uvmunmap: not aligned");
+
+    for (uint64 a = va; a < va + npages * PGSIZE; a += PGSIZE) {
+        pte_t *pte = walk(pagetable, a, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0)
+            continue;
+        if (!PTE_LEAF(*pte))
+            panic("uvmunmap: not a leaf");
+        if (do_free)
+            free_page((void *)PTE_PA(*pte));
+        *pte = 0;
+    }
+}
+
+// 递归释放页表页；调用前所有叶子映射必须已经拆掉
+static void
+freewalk(pagetable_t pagetable)
+{
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        if ((pte & PTE_V) == 0)
+            continue;
+        if (PTE_LEAF(pte))
+            panic("freewalk: leaf");
+        freewalk((pagetable_t)PTE_PA(pte));
+        pagetable[i] = 0;
+    }
+    free_page(pagetable);
+}
+
+// 释放 [0, sz) 的用户内存以及整棵页表
+void
+uvmfree(pagetable_t pagetable, uint64 sz)
+{
+    if (sz > 0)
+        uvmunmap(pagetable, 0, PGROUNDUP(sz) / PGSIZE, 1);
+    freewalk(pagetable);
+}
+
+// fork：把 old 中 [0, sz) 的用户页共享给 new，不复制物理页。
+// 可写页在两边都改成只读并打上 PTE_COW，物理页引用计数加一。
+// 调用者负责刷掉 old 所属地址空间的 TLB（W 位被收回了）。
+int
+uvmcopy_cow(pagetable_t old, pagetable_t new, uint64 sz)
+{
+    for (uint64 va = 0; va < sz; va += PGSIZE) {
+        pte_t *pte = walk(old, va, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0)
+            continue;   // 空洞（guard page 等）
+
+        if (*pte & PTE_W) {
+            *pte = (*pte & ~PTE_W) | PTE_COW;
+        }
+        uint64 pa = PTE_PA(*pte);
+        if (mappage(new, va, pa, PTE_FLAGS(*pte) & ~PTE_V) != 0) {
+            uvmunmap(new, 0, va / PGSIZE, 1);
+            return -1;
+        }
+        page_ref_inc((void *)pa);
+    }
+    return 0;
+}
+
+// 写缺页：va 所在页是 COW 页时给它一份私有可写的拷贝。
+// 只剩自己一个引用时不用复制，直接恢复写权限。
+// 页已经可写（比如 copyout 先一步复制了，TLB 里还是旧的只读项）也算成功。
+// 成功返回 0（调用者需要刷掉该 va 的 TLB 项），不是 COW 页或内存不足返回 -1。
+int
+uvm_cow_fault(pagetable_t pagetable, uint64 va)
+{
+    pte_t *pte = user_pte(pagetable, PGROUNDDOWN(va));
+    if (pte == 0)
+        return -1;
+    if (*pte & PTE_W)
+        return 0;
+    if ((*pte & PTE_COW) == 0)
+        return -1;
+
+    uint64 pa = PTE_PA(*pte);
+    uint64 flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    if (page_refcnt((void *)pa) == 1) {
+        *pte = PA2PTE(pa) | flags;
+        return 0;
+    }
+
+    char *mem = (char *)alloc_page_tag(MT_USER);
+    if (mem == 0)
+        return -1;
+    const char *src = (const char *)pa;
+    for (int i = 0; i < PGSIZE; i++)
+        mem[i] = src[i];
+
+    *pte = PA2PTE(mem) | flags;
+    free_page((void *)pa);   // 少一个引用
+    return 0;
+}
+
+// 缺页处理的页表部分：
+//   - va 所在页未映射：分配一页清零的页，按 R|W|U 映射（懒分配的堆和栈）；
+//   - 已映射、write 且是 COW 页：复制一份私有页；
+//   - 已映射且权限够：TLB 里的旧项导致的缺页，什么都不用做。
+// va 是否落在合法的用户区域由调用者（proc_fault）判断。成功返回 0。
+int
+uvm_fault_in(pagetable_t pagetable, uint64 va, int write)
+{
+    uint64 va0 = PGROUNDDOWN(va);
+    pte_t *pte = walk(pagetable, va0, 0);
+
+    if (pte && (*pte & PTE_V)) {
+        if ((*pte & PTE_U) == 0)
+            return -1;
+        return write ? uvm_cow_fault(pagetable, va0) : 0;
+    }
+
+    char *mem = (char *)alloc_page_tag(MT_USER);
+    if (mem == 0)
+        return -1;
+    memset_local(mem, 0, PGSIZE);
+    if (mappage(pagetable, va0, (uint64)mem, PTE_R | PTE_W | PTE_U) != 0) {
+        free_page(mem);
+        return -1;
+    }
+    return 0;
+}
+
+// copyin/copyout 用：取用户页的 PTE，页还没分配或者要写 COW 页时，
+// 替当前进程走一遍缺页处理（内核不经用户页表访问用户内存，不会真的触发缺页）
+static pte_t *
+user_pte_fault(pagetable_t pagetable, uint64 va, int write)
+{
+    pte_t *pte = user_pte(pagetable, va);
+    if (pte && (!write || (*pte & PTE_W)))
+        return pte;
+
+    struct proc *p = myproc();
+    if (p == 0 || p->pagetable != pagetable || proc_fault(p, va, write) < 0)
+        return 0;
+    return user_pte(pagetable, va);
+}
+
+// 内核 -> 用户：把 src 的 len 字节拷到用户地址 dstva，目标页必须可写。
+int
+copyout(pagetable_t pagetable, uint64 dstva, const void *src, uint64 len)
+{
+    const char *s = (const char *)src;
+
+    while (len > 0) {
+        uint64 va0 = PGROUNDDOWN(dstva);
+        pte_t *pte = user_pte_fault(pagetable, va0, 1);
+        if (pte == 0 || (*pte & PTE_W) == 0)
+            return -1;
+        // 内核直接写物理页，硬件不会替我们置 D 位；MAP_SHARED 的页靠它决定是否写回
+        *pte |= PTE_A | PTE_D;
+
+        uint64 n = PGSIZE - (dstva - va0);
+        if (n > len)
+            n = len;
+        char *d = (char *)(PTE_PA(*pte) + (dstva - va0));
+        for (uint64 i = 0; i < n; i++)
+            d[i] = s[i];
+
+        len   -= n;
+        s     += n;
+        dstva += n;
+    }
+    return 0;
+}
+
+// 用户 -> 内核：从用户地址 srcva 拷 len 字节到 dst，源页必须可读
+int
+copyin(pagetable_t pagetable, void *dst, uint64 srcva, uint64 len)
+{
+    char *d = (char *)dst;
+
+    while (len > 0) {
+        uint64 va0 = PGROUNDDOWN(srcva);
+        pte_t *pte = user_pte_fault(pagetable, va0, 0);
+        if (pte == 0 || (*pte & PTE_R) == 0)
+            return -1;
+
+        uint64 n = PGSIZE - (srcva - va0);
+        if (n > len)
+            n = len;
+        const char *s = (const char *)(PTE_PA(*pte) + (srcva - va0));
+        for (uint64 i = 0; i < n; i++)
+            d[i] = s[i];
+
+        len   -= n;
+        d     += n;
+        srcva += n;
+    }
+    return 0;
+}
+
+// 从用户地址 srcva 拷一个以 0 结尾的字符串，最多 max 字节（含结尾 0）。
+// 成功返回字符串长度（不含结尾 0），越界或太长返回 -1。
+int
+copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+{
+    uint64 got = 0;
+
+    while (got < max) {
+        uint64 va0 = PGROUNDDOWN(srcva);
+        pte_t *pte = user_pte_fault(pagetable, va0, 0);
+        if (pte == 0 || (*pte & PTE_R) == 0)
+            return -1;
+
+        const char *s = (const char *)(PTE_PA(*pte) + (srcva - va0));
+        uint64 n = PGSIZE - (srcva - va0);
+        for (uint64 i = 0; i < n && got < max; i++, got++) {
+            dst[got] = s[i];
+            if (s[i] == 0)
+                return (int)got;
+        }
+        srcva = va0 + PGSIZE;
+    }
+    return -1;
+}
+
+// 链接脚本里导出的符号：代码段结束、只读数据结束（都按页对齐）
 extern char etext[];
+extern char erodata[];
+
+// trampoline.S：用户态陷入/返回代码，占一整页
+extern char trampoline[];
 
 // -------- 构建并启用内核页表 --------
 
@@ -150,22 +450,43 @@ kvminit(void)
     if (kernel_pagetable == 0)
         panic("kvminit: no memory for kernel_pagetable");
 
-    // 1. 恒等映射整个内核物理内存 [KERNBASE, PHYSTOP)，R/W/X 都打开
-    //    这样起始地址 KERNBASE 和大小 PHYSTOP-KERNBASE 都是页面对齐的。
+    // 1. 恒等映射内核物理内存，按段区分权限（W^X）：
+    //    [KERNBASE, etext)    代码          R|X
+    //    [etext, erodata)     只读数据      R
+    //    [erodata, phys_top)  数据/BSS/空闲 R|W（对齐后用大页）
+    //    内核映射在所有地址空间里都一样，标 PTE_G，切换地址空间时不必刷掉。
     kvmmap(kernel_pagetable,
            KERNBASE,
            KERNBASE,
-           PHYSTOP - KERNBASE,
-           PTE_R | PTE_W | PTE_X);
+           (uint64)etext - KERNBASE,
+           PTE_R | PTE_X | PTE_G);
+
+    kvmmap(kernel_pagetable,
+           (uint64)etext,
+           (uint64)etext,
+           (uint64)erodata - (uint64)etext,
+           PTE_R | PTE_G);
+
+    kvmmap(kernel_pagetable,
+           (uint64)erodata,
+           (uint64)erodata,
+           phys_top - (uint64)erodata,
+           PTE_R | PTE_W | PTE_G);
 
     // 2. 设备内存：UART0（同样是恒等映射）
     kvmmap(kernel_pagetable,
            UART0,
            UART0,
            PGSIZE,
-           PTE_R | PTE_W);
+           PTE_R | PTE_W | PTE_G);
+
+    // 3. trampoline：和用户页表里映射在同一个虚拟地址，切换 satp 前后指令流连续
+    if (mapleaf(kernel_pagetable, TRAMPOLINE, (uint64)trampoline, 0,
+                PTE_R | PTE_X | PTE_G) != 0)
+        panic("kvminit: map trampoline");
 
-    printf("kvminit: kernel page table built.\n");
+    printf("kvminit: kernel page table built (%d x 1GB, %d x 2MB, %d x 4KB leaves).\n",
+           (int)kvm_nleaf[2], (int)kvm_nleaf[1], (int)kvm_nleaf[0]);
 }
 
 void
@@ -178,5 +499,10 @@ kvminithart(void)
     w_satp(satp);
     sfence_vma();
 
-    printf("kvminithart: paging enabled.\n");
+    // 探测 ASID 宽度：往 ASID 字段写全 1，读回来的就是硬件实际支持的位
+    w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+    asid_max = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    w_satp(satp);
+
+    printf("kvminithart: paging enabled, asid_max=%d.\n", (int)asid_max);
 }
@@ -0,0 +1,188 @@
+// kernel/writeback.c
+// 后台写回：write() 只把数据拷进页缓存、打上脏标记就返回，
+// 块分配、数据落盘和日志提交都由这里集中完成。
+//
+//  - 有脏页的 inode 在 pc.pinned 上替写回多拿一个引用，写干净后才放掉；
+//  - 写回按事务切片，每个事务的页数按日志容量算（日志越大，大文件写回的提交次数越少），
+//    inode 的 size/addrs 和它们用到的块在同一个事务里更新；
+//  - 脏页超过 WB_DIRTY_BACKGROUND、或者脏数据/攒着的日志放得超过 WB_EXPIRE 时，
+//    用 kproc_create 起一个写回线程，写完这一批就退出，不在线程里轮询等下一个期限；
+//    期限由写者（end_op/filewrite/munmap）和用户态的时钟中断（trap.c）检查，
+//    没有脏数据时这个检查只是两次比较，有脏数据时扫一遍 inode 缓存看 dirtied_when；
+//  - 脏页超过 WB_DIRTY_LIMIT 时写者在 filewrite 里同步写回（限流）；
+//  - fsync/fdatasync 写回一个文件，再只在它的改动还没提交时提交日志；
+//    sync 写回所有文件并提交。
+
+#include "types.h"
+#include "printf.h"
+#include "riscv.h"
+#include "fs.h"
+#include "fs_debug.h"
+#include "pagecache.h"
+#include "proc.h"
+
+uint64 writeback_pages = 0;   // 写回到磁盘的页数
+uint64 writeback_runs  = 0;   // 写回线程跑了多少轮
+
+// 当前的写回线程。proc_init 会把进程表整个清掉，所以要连 pid 一起核对
+static struct proc *wb_proc;
+static int wb_pid;
+
+int
+writeback_inode(struct inode *ip)
+{
+    int total = 0;
+
+    for (;;) {
+        // 按剩下的脏页数预留，不多占日志，别的操作还能接着攒进同一批；
+        // 至少留 MAXOPBLOCKS 块，最后的 iput 可能要删文件
+        int max = log_op_max() - WB_OP_OVERHEAD;
+        int pages = ip->pc.nrdirty < (uint32)max ? (int)ip->pc.nrdirty : max;
+        int budget = pages + WB_OP_OVERHEAD;
+
+        begin_op_n(budget > MAXOPBLOCKS ? budget : MAXOPBLOCKS);
+        ilock(ip);
+        if (ip->nlink == 0) {
+            pcache_truncate(ip, 0);   // 已经删掉的文件，脏页不必再写
+        }
+        int n = pcache_writeback(ip, pages);
+        if (ip->idirty) {
+            iupdate(ip);   // 和新分配的块在同一个事务里
+        }
+        int more  = ip->pc.nrdirty > 0;
+        int unpin = !more && ip->pc.pinned;
+        if (unpin) {
+            ip->pc.pinned = 0;
+        }
+        iunlock(ip);
+        if (unpin) {
+            iput(ip);   // 可能是最后一个引用（文件已经删了），删除也要在事务里
+        }
+        end_op();
+
+        total += n;
+        if (!more) {
+            break;
+        }
+    }
+
+    writeback_pages += total;
+    return total;
+}
+
+// 写回脏 inode：all 为 0 时只写脏了超过 WB_EXPIRE 的，最后提交日志
+static void
+writeback_pass(int all)
+{
+    uint64 now = r_time();
+
+    for (struct inode *ip = icache.inode; ip < icache.inode + NINODE; ip++) {
+        // pinned 的 inode ref > 0，持锁检查后加一个引用就不会被换出
+        mcs_acquire(&icache.lock);
+        if (!ip->pc.pinned || (!all && now - ip->pc.dirtied_when < WB_EXPIRE)) {
+            mcs_release(&icache.lock);
+            continue;
+        }
+        __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
+        mcs_release(&icache.lock);
+
+        writeback_inode(ip);
+
+        begin_op();
+        iput(ip);
+        end_op();
+    }
+
+    log_force();
+}
+
+// 有没有到期的写回工作
+static int
+writeback_needed(void)
+{
+    uint64 dirty = __atomic_load_n(&pcache_dirty, __ATOMIC_RELAXED);
+    if (dirty == 0 && log.lh.n == 0) {
+        return 0;   // 时钟中断每次都来问，常见情况不扫 inode
+    }
+    if (dirty > WB_DIRTY_BACKGROUND) {
+        return 1;
+    }
+
+    uint64 now = r_time();
+    if (log.lh.n > 0 && now - log.since >= WB_EXPIRE) {
+        return 1;
+    }
+    for (struct inode *ip = icache.inode; ip < icache.inode + NINODE; ip++) {
+        if (ip->pc.pinned && now - ip->pc.dirtied_when >= WB_EXPIRE) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+wb_running(void)
+{
+    return wb_proc != 0 && wb_proc->pid == wb_pid &&
+           (wb_proc->state == PROC_RUNNABLE || wb_proc->state == PROC_RUNNING);
+}
+
+static void
+wb_daemon(void)
+{
+    // 通常一轮就写完了；写者还在把脏页推过后台阈值时让它们跑一会儿再写下一批
+    while (writeback_needed()) {
+        writeback_pass(__atomic_load_n(&pcache_dirty, __ATOMIC_RELAXED) > WB_DIRTY_BACKGROUND);
+        writeback_runs++;
+        if (writeback_needed()) {
+            yield();
+        }
+    }
+
+    wb_proc = 0;
+    kproc_exit();
+}
+
+void
+writeback_kick(void)
+{
+    // 不在调度器跑的线程里（开机阶段、测试里的假进程没有内核栈）时
+    // 新线程没人来跑，数据留在缓存里等 fsync/sync
+    struct proc *cur = myproc();
+    if (cur == 0 || cur->kstack == 0 || wb_running() || !writeback_needed()) {
+        return;
+    }
+
+    struct proc *p = kproc_create(wb_daemon, "writeback");
+    if (p) {
+        wb_proc = p;
+        wb_pid  = p->pid;
+    }
+}
+
+void
+writeback_balance(void)
+{
+    if (__atomic_load_n(&pcache_dirty, __ATOMIC_RELAXED) > WB_DIRTY_LIMIT) {
+        writeback_pass(1);
+    } else {
+        writeback_kick();
+    }
+}
+
+int
+writeback_fsync(struct inode *ip, int datasync)
+{
+    writeback_inode(ip);
+
+    ilock(ip);
+    uint64 seq = datasync ? ip->datasync_seq : ip->sync_seq;
+    iunlock(ip);
+    return log_force_seq(seq);
+}
+
+void
+writeback_sync(void)
+{
+    writeback_pass(1);
+}